@@ -92,8 +92,16 @@ typedef struct {
   i32 count;
 } Texture_Atlas;
 
+#define FONT_SUBPIXEL_PHASES 4
+
 typedef struct {
+  // glyph of codepoint index i shifted right by k/subpixel_phases pixels
+  // is atlas.rects[i*subpixel_phases + k]
   Texture_Atlas atlas;
+  i32 subpixel_phases;
+  // lcd glyphs keep per-channel coverage in rgb, otherwise coverage is in alpha
+  b32 lcd;
+
   char first_codepoint;
   i32 codepoint_count;
   V2 *origins;
@@ -131,7 +139,7 @@ struct Grid_Props {
 
 struct Element {
   Rect2 rect;
-  Element *children;
+  Array<Element> children;
 
   Pixel color;
   Grid_Props grid_props;
@@ -170,7 +178,7 @@ globalvar bool loaded = false;
 
 void ui_grid_begin(Layout *layout, Grid_Props props) {
   Element e = {
-    .children = sb_make(Element, 16),
+    .children = make_array<Element>(16),
   };
 
 }
@@ -256,32 +264,62 @@ V4_8x bilinear_blend(Bilinear_Sample_8x sample, V2_8x c) {
   return abcd;
 }
 
-void draw_rect_avx(Bitmap screen, V2 p, V2 size, f32 angle, Pixel color, Rect2i clip_rect) {
-  Rect2 rect = rect2_center_size(p, size);
-
-  Rect2 bitmap_rect = add_radius(rect, {1, 1});
-  V2 bitmap_rect_size = get_size(bitmap_rect);
+struct Quad_Setup {
+  V2 origin;
+  Mat2 xform;
+  Rect2 bounds;
+};
 
-  Mat4 rotation_matrix = rotate({0, 0, angle})*scale(v3(bitmap_rect_size, 0));
+// per-primitive setup for rotated quads, done 8 quads at a time
+void setup_quads(V2_SoA p, V2_SoA size, f32 *angle, u32 count, Quad_Setup *result) {
+  // NOTE: chunked so the soa temporaries stay small in scratch
+  u32 chunk_capacity = 256;
+  Mem_Size scratch_mark = scratch_get_mark();
+
+  f32 *soa = (f32 *)scratch_alloc(sizeof(f32)*chunk_capacity*12);
+  V2_SoA padded_size = {soa, soa + chunk_capacity};
+  V2_SoA origin = {soa + chunk_capacity*2, soa + chunk_capacity*3};
+  V2_SoA x_axis = {soa + chunk_capacity*4, soa + chunk_capacity*5};
+  V2_SoA y_axis = {soa + chunk_capacity*6, soa + chunk_capacity*7};
+  Rect2_SoA bounds = {
+    soa + chunk_capacity*8, soa + chunk_capacity*9,
+    soa + chunk_capacity*10, soa + chunk_capacity*11,
+  };
 
-  V2 x_axis = get_col(rotation_matrix, 0).xy;
-  V2 y_axis = get_col(rotation_matrix, 1).xy;
-  V2 origin = get_center(bitmap_rect) - x_axis*0.5f - y_axis*0.5f;
+  for (u32 chunk_start = 0; chunk_start < count; chunk_start += chunk_capacity) {
+    u32 chunk_count = min(count - chunk_start, chunk_capacity);
+    V2_SoA chunk_p = {p.x + chunk_start, p.y + chunk_start};
 
-  V2 vertices[] = {origin, origin + x_axis, origin + y_axis, origin + x_axis + y_axis};
+    // NOTE: quads are drawn with a 1 pixel apron on every side
+    for (u32 i = 0; i < chunk_count; i++) {
+      padded_size.x[i] = size.x[chunk_start + i] + 2;
+      padded_size.y[i] = size.y[chunk_start + i] + 2;
+    }
 
-  Rect2 drawn_rect = inverted_infinity_rect();
-  for (u32 vertex_index = 0; vertex_index < array_count(vertices); vertex_index++) {
-    V2 vertex = vertices[vertex_index];
+    rotate_rects(chunk_p, padded_size, angle + chunk_start, origin, x_axis, y_axis, chunk_count);
+    get_bounds(origin, x_axis, y_axis, bounds, chunk_count);
 
-    drawn_rect.min.x = min(drawn_rect.min.x, vertex.x);
-    drawn_rect.min.y = min(drawn_rect.min.y, vertex.y);
-    drawn_rect.max.x = max(drawn_rect.max.x, vertex.x);
-    drawn_rect.max.y = max(drawn_rect.max.y, vertex.y);
+    for (u32 i = 0; i < chunk_count; i++) {
+      Mat2 axes = {x_axis.x[i], y_axis.x[i], x_axis.y[i], y_axis.y[i]};
+      result[chunk_start + i] = {
+        .origin = {origin.x[i], origin.y[i]},
+        .xform = inverse(axes),
+        .bounds = {{bounds.min_x[i], bounds.min_y[i]}, {bounds.max_x[i], bounds.max_y[i]}},
+      };
+    }
   }
 
-  Rect2i paint_rect = intersect(clip_rect, rect2i(drawn_rect));
-  V2 rect_size = get_size(drawn_rect);
+  scratch_set_mark(scratch_mark);
+}
+
+Quad_Setup setup_quad(V2 p, V2 size, f32 angle) {
+  Quad_Setup result;
+  setup_quads({&p.x, &p.y}, {&size.x, &size.y}, &angle, 1, &result);
+  return result;
+}
+
+Rect2i get_paint_rect(Quad_Setup quad, Rect2i clip_rect) {
+  Rect2i paint_rect = intersect(clip_rect, rect2i(quad.bounds));
 
   if (paint_rect.min.x & 7) {
     paint_rect.min.x = paint_rect.min.x & (~7);
@@ -289,14 +327,16 @@ void draw_rect_avx(Bitmap screen, V2 p, V2 size, f32 angle, Pixel color, Rect2i
   if (paint_rect.max.x & 7) {
     paint_rect.max.x = (paint_rect.max.x & (~7)) + 8;
   }
+  return paint_rect;
+}
+
+void draw_rect_avx(Bitmap screen, Quad_Setup quad, Pixel color, Rect2i clip_rect) {
+  Rect2i paint_rect = get_paint_rect(quad, clip_rect);
 
-  V2i paint_size = get_size(paint_rect);
-  V2 inverse_axis_length_sqr = 1/sqr(bitmap_rect_size);
-  V2_8x inverse_axis_length_sqr_8x = set8(inverse_axis_length_sqr);
-  V2_8x origin_8x = set8(origin);
-  f32_8x pixel_x_offsets = {0, 1, 2, 3, 4, 5, 6, 7};
+  V2_8x origin_8x = set8(quad.origin);
+  f32_8x pixel_x_offsets = lane_index_8x();
   f32_8x eight_8x = set8(8);
-  Mat2_8x xform = inverse(set8(mat2(rotation_matrix)));
+  Mat2_8x xform = set8(quad.xform);
 
   V4_8x texel = pixel_u32_to_v4_8x(set8i((i32)color.rgba));
   
@@ -308,7 +348,7 @@ void draw_rect_avx(Bitmap screen, V2 p, V2 size, f32 angle, Pixel color, Rect2i
 
       for (i32 x = paint_rect.min.x; x < paint_rect.max.x; x += 8) {
         V2_8x uv01 = xform*d;
-        i32_8x write_mask = to_i32_8x((uv01.x >= 0) & (uv01.x < 1) & (uv01.y >= 0) & (uv01.y < 1));
+        i32_8x write_mask = inside_unit_square_mask(uv01);
 
         Pixel *pixel_ptr = screen.data + y*screen.pitch + x;
         i32_8x pixel_u32 = load_i32_8x(pixel_ptr);
@@ -324,41 +364,30 @@ void draw_rect_avx(Bitmap screen, V2 p, V2 size, f32 angle, Pixel color, Rect2i
   }
 }
 
-void draw_bitmap_avx(Bitmap screen, V2 p, V2 size, f32 angle, Bitmap bmp, Rect2i clip_rect, Rect2i sprite_rect) {
-  Rect2 rect = rect2_center_size(p, size);
-
-  Rect2 bitmap_rect = add_radius(rect, {1, 1});
-  V2 bitmap_rect_size = get_size(bitmap_rect);
-
-  Mat4 rotation_matrix = rotate({0, 0, angle})*scale(v3(bitmap_rect_size, 0));
-
-  V2 x_axis = get_col(rotation_matrix, 0).xy;
-  V2 y_axis = get_col(rotation_matrix, 1).xy;
-  V2 origin = get_center(bitmap_rect) - x_axis*0.5f - y_axis*0.5f;
-
-  V2 vertices[] = {origin, origin + x_axis, origin + y_axis, origin + x_axis + y_axis};
-
-  Rect2 drawn_rect = inverted_infinity_rect();
-  for (u32 vertex_index = 0; vertex_index < array_count(vertices); vertex_index++) {
-    V2 vertex = vertices[vertex_index];
+// premultiplied texel*tint, tint is a straight-alpha color
+V4_8x get_tint_modulate(Pixel tint) {
+  f32 alpha = (f32)tint.a/255.0f;
+  V4_8x result;
+  result.r = set8((f32)tint.r/255.0f*alpha);
+  result.g = set8((f32)tint.g/255.0f*alpha);
+  result.b = set8((f32)tint.b/255.0f*alpha);
+  result.a = set8(alpha);
+  return result;
+}
 
-    drawn_rect.min.x = min(drawn_rect.min.x, vertex.x);
-    drawn_rect.min.y = min(drawn_rect.min.y, vertex.y);
-    drawn_rect.max.x = max(drawn_rect.max.x, vertex.x);
-    drawn_rect.max.y = max(drawn_rect.max.y, vertex.y);
-  }
+struct Vertex_Colors {
+  // corners at uv (0, 0), (1, 0), (0, 1), (1, 1)
+  Pixel c00, c10, c01, c11;
+};
 
-  Rect2i paint_rect = intersect(clip_rect, rect2i(drawn_rect));
-  V2 rect_size = get_size(drawn_rect);
+Vertex_Colors vertex_colors(Pixel color) {
+  Vertex_Colors result = {color, color, color, color};
+  return result;
+}
 
-  if (paint_rect.min.x & 7) {
-    paint_rect.min.x = paint_rect.min.x & (~7);
-  }
-
-  if (paint_rect.max.x & 7) {
-    paint_rect.max.x = (paint_rect.max.x & (~7)) + 8;
-  }
-  V2i paint_size = get_size(paint_rect);
+void draw_bitmap_avx(Bitmap screen, Quad_Setup quad, Bitmap bmp, Rect2i clip_rect, Rect2i sprite_rect, Vertex_Colors colors) {
+  Rect2i paint_rect = get_paint_rect(quad, clip_rect);
+  V2 rect_size = get_size(quad.bounds);
 
   V2 texture_size = v2(bmp.width, bmp.height);
   if (sprite_rect.max.x || sprite_rect.max.y || sprite_rect.min.x || sprite_rect.min.y) {
@@ -368,19 +397,22 @@ void draw_bitmap_avx(Bitmap screen, V2 p, V2 size, f32 angle, Bitmap bmp, Rect2i
 
   V2 pixel_scale = rect_size/texture_size;
 
-  V2 inverse_axis_length_sqr = 1/sqr(bitmap_rect_size);
-
-  V2_8x inverse_axis_length_sqr_8x = set8(inverse_axis_length_sqr);
-
   V2_8x texture_size_8x = set8(texture_size);
   V2_8x pixel_scale_8x = set8(pixel_scale);
-  V2_8x origin_8x = set8(origin);
+  V2_8x origin_8x = set8(quad.origin);
 
-  f32_8x pixel_x_offsets = {0, 1, 2, 3, 4, 5, 6, 7};
+  f32_8x pixel_x_offsets = lane_index_8x();
   f32_8x eight_8x = set8(8);
 
   V2_8x texture_size_with_apron = texture_size_8x + 2/pixel_scale_8x;
-  Mat2_8x xform = inverse(set8(mat2(rotation_matrix)));
+  Mat2_8x xform = set8(quad.xform);
+
+  bool is_gradient = colors.c00.rgba != colors.c10.rgba || colors.c00.rgba != colors.c01.rgba ||
+    colors.c00.rgba != colors.c11.rgba;
+  V4_8x modulate00 = get_tint_modulate(colors.c00);
+  V4_8x modulate10 = get_tint_modulate(colors.c10);
+  V4_8x modulate01 = get_tint_modulate(colors.c01);
+  V4_8x modulate11 = get_tint_modulate(colors.c11);
   
   if (has_area(paint_rect)) {
     TIMED_BLOCK(draw_pixel_avx, (u64)get_area(paint_rect));
@@ -395,9 +427,15 @@ void draw_bitmap_avx(Bitmap screen, V2 p, V2 size, f32 angle, Bitmap bmp, Rect2i
         V2_8x floored_uv = floor(uv);
         V2_8x fract_uv = clamp01((uv - floored_uv)*pixel_scale_8x);
 
-        i32_8x write_mask = to_i32_8x((uv01.x >= 0) & (uv01.x < 1) & (uv01.y >= 0) & (uv01.y < 1));
+        i32_8x write_mask = inside_unit_square_mask(uv01);
         Bilinear_Sample_8x sample = get_bilinear_sample(bmp, v2i_8x(floored_uv), write_mask);
-        V4_8x texel = bilinear_blend(sample, fract_uv);
+
+        V4_8x modulate = modulate00;
+        if (is_gradient) {
+          V2_8x t = clamp01(uv01);
+          modulate = lerp(lerp(modulate00, modulate10, t.x), lerp(modulate01, modulate11, t.x), t.y);
+        }
+        V4_8x texel = bilinear_blend(sample, fract_uv)*modulate;
 
         Pixel *pixel_ptr = screen.data + y*screen.pitch + x;
         i32_8x pixel_u32 = load_i32_8x(pixel_ptr);
@@ -413,6 +451,10 @@ void draw_bitmap_avx(Bitmap screen, V2 p, V2 size, f32 angle, Bitmap bmp, Rect2i
   }
 }
 
+void draw_bitmap_avx(Bitmap screen, Quad_Setup quad, Bitmap bmp, Rect2i clip_rect, Rect2i sprite_rect, Pixel tint) {
+  draw_bitmap_avx(screen, quad, bmp, clip_rect, sprite_rect, vertex_colors(tint));
+}
+
 struct Render_Region_Task {
   Rect2i region;
   Bitmap screen;
@@ -422,14 +464,16 @@ struct Render_Region_Task {
   Bitmap bmp;
   Pixel color;
   Rect2i sprite_rect;
+
+  Quad_Setup quad;
 };
 
 void do_render_bitmap_region_task(Render_Region_Task *task) {
-  draw_bitmap_avx(task->screen, task->p, task->size, task->angle, task->bmp, task->region, task->sprite_rect);
+  draw_bitmap_avx(task->screen, task->quad, task->bmp, task->region, task->sprite_rect, task->color);
 }
 
 void do_render_rect_region_task(Render_Region_Task *task) {
-  draw_rect_avx(task->screen, task->p, task->size, task->angle, task->color, task->region);
+  draw_rect_avx(task->screen, task->quad, task->color, task->region);
 }
 
 struct Line_Params {
@@ -443,19 +487,25 @@ void draw_line_threaded(Thread_Queue *queue, Line_Params params) {
 #define REGION_COUNT 24
   Render_Region_Task tasks[REGION_COUNT];
   int foo = 32;
+
+  V2 line = params.end - params.start;
+  V2 p = params.start + line*0.5f;
+  V2 size = {len(line), params.thickness};
+  f32 angle = get_angle(line);
+  Quad_Setup quad = setup_quad(p, size, angle);
+
   for (i32 region_index = 0; region_index < REGION_COUNT; region_index += 1) {
     V2i region_size = {params.screen.width, params.screen.height/REGION_COUNT};
     Rect2i region = rect2i_min_size({0, region_size.y*region_index}, region_size);
 
-    V2 line = params.end - params.start;
-
     tasks[region_index] = {
       .screen = params.screen,
       .region = region,
-      .p = params.start + line*0.5f,
-      .size = {len(line), params.thickness},
-      .angle = get_angle(line),
+      .p = p,
+      .size = size,
+      .angle = angle,
       .color = params.color,
+      .quad = quad,
     };
 
     add_thread_task(queue, (Worker_Fn)do_render_rect_region_task, tasks + region_index);
@@ -467,6 +517,7 @@ void draw_line_threaded(Thread_Queue *queue, Line_Params params) {
 void draw_rect_threaded(Thread_Queue *queue, Render_Region_Task params) {
 #define REGION_COUNT 24
   Render_Region_Task tasks[REGION_COUNT];
+  params.quad = setup_quad(params.p, params.size, params.angle);
   for (i32 region_index = 0; region_index < REGION_COUNT; region_index += 1) {
     V2i region_size = {params.screen.width, params.screen.height/REGION_COUNT};
     Rect2i region = rect2i_min_size({0, region_size.y*region_index}, region_size);
@@ -482,6 +533,7 @@ void draw_rect_threaded(Thread_Queue *queue, Render_Region_Task params) {
 void draw_bitmap_threaded(Thread_Queue *queue, Render_Region_Task params) {
 #define REGION_COUNT 24
   Render_Region_Task tasks[REGION_COUNT];
+  params.quad = setup_quad(params.p, params.size, params.angle);
   for (i32 region_index = 0; region_index < REGION_COUNT; region_index += 1) {
     V2i region_size = {params.screen.width, params.screen.height/REGION_COUNT};
     Rect2i region = rect2i_min_size({0, region_size.y*region_index}, region_size);
@@ -494,215 +546,779 @@ void draw_bitmap_threaded(Thread_Queue *queue, Render_Region_Task params) {
 #undef REGION_COUNT
 }
 
+struct Sprite {
+  V2 p;
+  V2 size;
+  f32 angle;
+  Rect2i sprite_rect;
+  Pixel tint;
+};
+
+#define SPRITE_TILE_SIZE 64
+#define SPRITE_BATCH_MAX_TASKS 32
+
+struct Sprite_Batch {
+  Bitmap screen;
+  Bitmap texture;
+  Sprite *sprites;
+  Vertex_Colors *vertex_colors;
+  Quad_Setup *quads;
+
+  i32 tiles_x;
+  i32 tiles_y;
+  // sprites overlapping tile t are tile_sprites[tile_offsets[t]..tile_offsets[t + 1]]
+  u32 *tile_offsets;
+  u32 *tile_sprites;
+};
+
+struct Sprite_Batch_Task {
+  Sprite_Batch *batch;
+  i32 tile_row_begin;
+  i32 tile_row_end;
+};
+
+struct Sprite_Bin_Entry {
+  u32 tile;
+  u32 sprite;
+};
+
+// bins sprites [sprite_begin, sprite_end), entries come out in sprite order
+struct Sprite_Bin_Task {
+  Sprite_Batch *batch;
+  Shared_Arena *arena;
+  u32 sprite_begin;
+  u32 sprite_end;
+  Array<Sprite_Bin_Entry> entries;
+};
+
+#define SPRITE_BIN_MIN_SPRITES_PER_TASK 1024
+
+// tile lists of the binning tasks, reset once the batch is sorted
+globalvar Shared_Arena _sprite_bins;
+
+Rect2i get_tile_range(Sprite_Batch *batch, Rect2 bounds) {
+  Rect2i screen_rect = {{0, 0}, {batch->screen.width, batch->screen.height}};
+  Rect2i paint_rect = intersect(screen_rect, rect2i(bounds));
+  Rect2i result = {};
+  if (has_area(paint_rect)) {
+    result = {
+      {paint_rect.min.x/SPRITE_TILE_SIZE, paint_rect.min.y/SPRITE_TILE_SIZE},
+      {(paint_rect.max.x - 1)/SPRITE_TILE_SIZE + 1, (paint_rect.max.y - 1)/SPRITE_TILE_SIZE + 1},
+    };
+  }
+  return result;
+}
+
+void do_bin_sprites_task(Sprite_Bin_Task *task) {
+  Sprite_Batch *batch = task->batch;
+  Context_Scope scope = push_context(task->arena);
+  task->entries = make_array<Sprite_Bin_Entry>();
+  for (u32 i = task->sprite_begin; i < task->sprite_end; i++) {
+    Rect2i tiles = get_tile_range(batch, batch->quads[i].bounds);
+    for (i32 y = tiles.min.y; y < tiles.max.y; y++) {
+      for (i32 x = tiles.min.x; x < tiles.max.x; x++) {
+        array_push(&task->entries, {(u32)(y*batch->tiles_x + x), i});
+      }
+    }
+  }
+}
+
+void do_render_sprite_tiles_task(Sprite_Batch_Task *task) {
+  Sprite_Batch *batch = task->batch;
+  for (i32 tile_y = task->tile_row_begin; tile_y < task->tile_row_end; tile_y++) {
+    for (i32 tile_x = 0; tile_x < batch->tiles_x; tile_x++) {
+      i32 tile_index = tile_y*batch->tiles_x + tile_x;
+      Rect2i tile_rect = rect2i_min_size({tile_x*SPRITE_TILE_SIZE, tile_y*SPRITE_TILE_SIZE},
+                                         {SPRITE_TILE_SIZE, SPRITE_TILE_SIZE});
+      tile_rect = intersect(tile_rect, {{0, 0}, {batch->screen.width, batch->screen.height}});
+
+      for (u32 i = batch->tile_offsets[tile_index]; i < batch->tile_offsets[tile_index + 1]; i++) {
+        u32 sprite_index = batch->tile_sprites[i];
+        Sprite *sprite = batch->sprites + sprite_index;
+        Vertex_Colors colors = batch->vertex_colors ? batch->vertex_colors[sprite_index] : vertex_colors(sprite->tint);
+        draw_bitmap_avx(batch->screen, batch->quads[sprite_index], batch->texture,
+                        tile_rect, sprite->sprite_rect, colors);
+      }
+    }
+  }
+}
+
+// NOTE: sprites are drawn in array order within every tile,
+// so overlapping sprites still blend back to front.
+// vertex_colors, when given, has one entry per sprite and replaces the tint
+void draw_sprites_threaded(Thread_Queue *queue, Bitmap screen, Bitmap texture, Sprite *sprites, u32 count,
+                           Vertex_Colors *vertex_colors = nullptr)
+{
+  if (!count) return;
+
+  // NOTE: the batch is this frame's memory, begin_frame frees it
+  Sprite_Batch batch = {
+    .screen = screen,
+    .texture = texture,
+    .sprites = sprites,
+    .vertex_colors = vertex_colors,
+    .quads = (Quad_Setup *)frame_alloc(sizeof(Quad_Setup)*count),
+    .tiles_x = (screen.width + SPRITE_TILE_SIZE - 1)/SPRITE_TILE_SIZE,
+    .tiles_y = (screen.height + SPRITE_TILE_SIZE - 1)/SPRITE_TILE_SIZE,
+  };
+  u32 tile_count = (u32)(batch.tiles_x*batch.tiles_y);
+
+  f32 *soa = (f32 *)frame_alloc(sizeof(f32)*count*5);
+  V2_SoA p = {soa, soa + count};
+  V2_SoA size = {soa + count*2, soa + count*3};
+  f32 *angle = soa + count*4;
+  for (u32 i = 0; i < count; i++) {
+    p.x[i] = sprites[i].p.x;
+    p.y[i] = sprites[i].p.y;
+    size.x[i] = sprites[i].size.x;
+    size.y[i] = sprites[i].size.y;
+    angle[i] = sprites[i].angle;
+  }
+  setup_quads(p, size, angle, count, batch.quads);
+
+  // tasks bin sprite ranges into (tile, sprite) lists in a shared arena,
+  // then a counting sort over the lists in task order keeps sprite order
+  if (!_sprite_bins.data) _sprite_bins = make_shared_arena(gigabytes(1));
+  Sprite_Bin_Task bin_tasks[SPRITE_BATCH_MAX_TASKS];
+  u32 bin_task_count = min((count + SPRITE_BIN_MIN_SPRITES_PER_TASK - 1)/SPRITE_BIN_MIN_SPRITES_PER_TASK,
+                           (u32)SPRITE_BATCH_MAX_TASKS);
+  for (u32 task_index = 0; task_index < bin_task_count; task_index++) {
+    bin_tasks[task_index] = {
+      .batch = &batch,
+      .arena = &_sprite_bins,
+      .sprite_begin = (u32)((u64)count*task_index/bin_task_count),
+      .sprite_end = (u32)((u64)count*(task_index + 1)/bin_task_count),
+    };
+    add_thread_task(queue, (Worker_Fn)do_bin_sprites_task, bin_tasks + task_index);
+  }
+  wait_for_all_tasks(queue);
+
+  batch.tile_offsets = (u32 *)frame_alloc(sizeof(u32)*(tile_count + 1));
+  memset(batch.tile_offsets, 0, sizeof(u32)*(tile_count + 1));
+  for (u32 task_index = 0; task_index < bin_task_count; task_index++) {
+    for (Sprite_Bin_Entry entry : bin_tasks[task_index].entries) {
+      batch.tile_offsets[entry.tile + 1]++;
+    }
+  }
+  for (u32 t = 0; t < tile_count; t++) {
+    batch.tile_offsets[t + 1] += batch.tile_offsets[t];
+  }
+
+  u32 *cursors = (u32 *)frame_alloc(sizeof(u32)*tile_count);
+  memcpy(cursors, batch.tile_offsets, sizeof(u32)*tile_count);
+  batch.tile_sprites = (u32 *)frame_alloc(sizeof(u32)*max(batch.tile_offsets[tile_count], (u32)1));
+  for (u32 task_index = 0; task_index < bin_task_count; task_index++) {
+    for (Sprite_Bin_Entry entry : bin_tasks[task_index].entries) {
+      batch.tile_sprites[cursors[entry.tile]++] = entry.sprite;
+    }
+  }
+  shared_arena_reset(&_sprite_bins);
+
+  Sprite_Batch_Task tasks[SPRITE_BATCH_MAX_TASKS];
+  i32 task_count = min(batch.tiles_y, (i32)SPRITE_BATCH_MAX_TASKS);
+  for (i32 task_index = 0; task_index < task_count; task_index++) {
+    tasks[task_index] = {
+      .batch = &batch,
+      .tile_row_begin = batch.tiles_y*task_index/task_count,
+      .tile_row_end = batch.tiles_y*(task_index + 1)/task_count,
+    };
+    add_thread_task(queue, (Worker_Fn)do_render_sprite_tiles_task, tasks + task_index);
+  }
+  wait_for_all_tasks(queue);
+}
+
+// glyph coverage moved right by offset (0..1) pixels, one column wider
+Bitmap make_subpixel_phase(Bitmap glyph, f32 offset, Pixel empty) {
+  Bitmap result = make_empty_bitmap(glyph.width + 1, glyph.height);
+  for (i32 y = 0; y < result.height; y++) {
+    for (i32 x = 0; x < result.width; x++) {
+      Pixel left = x > 0 ? glyph.data[y*glyph.pitch + x - 1] : empty;
+      Pixel right = x < glyph.width ? glyph.data[y*glyph.pitch + x] : empty;
+      result.data[y*result.pitch + x] = lerp(right, left, offset);
+    }
+  }
+  return result;
+}
+
+Rect2i font_get_glyph_rect(Font *font, char c, i32 phase) {
+  i32 index = font_get_char(font, c)*font->subpixel_phases + phase;
+  Rect2i result = font->atlas.rects[index];
+  return result;
+}
+
+// NOTE: gamma 2 stands in for srgb, so decode is a square and encode a sqrt
+V3_8x srgb255_to_linear1(V3_8x c) {
+  V3_8x result = c*c*set8(1/(255.0f*255.0f));
+  return result;
+}
+
+V3_8x linear1_to_srgb255(V3_8x c) {
+  V3_8x result = {sqrt(c.r)*255.0f, sqrt(c.g)*255.0f, sqrt(c.b)*255.0f};
+  return result;
+}
+
+// 1:1 glyph blit at an integer position; the subpixel part of the
+// position is already baked into the glyph phase, so cost is fixed per texel.
+// The atlas has the 1px apron win32_read_bmp puts around bitmaps, glyph
+// rects don't count it
+void draw_glyph_avx(Bitmap screen, V2i p, Bitmap atlas, Rect2i glyph_rect, Pixel color,
+                    Rect2i clip_rect, b32 lcd)
+{
+  Rect2i dest_rect = rect2i_min_size(p, get_size(glyph_rect));
+  Rect2i paint_rect = intersect(dest_rect, clip_rect);
+  if (!has_area(paint_rect)) return;
+
+  V4_8x color_8x = pixel_u32_to_v4_8x(set8i((i32)color.rgba));
+  V3_8x color_linear = srgb255_to_linear1(color_8x.rgb);
+  f32_8x coverage_scale = color_8x.a*(1/(255.0f*255.0f));
+
+  i32 width = get_size(paint_rect).x;
+  V2i src_offset = paint_rect.min - dest_rect.min;
+  f32_8x lane_index = lane_index_8x();
+
+  for (i32 y = paint_rect.min.y; y < paint_rect.max.y; y++) {
+    Pixel *src_row = atlas.data + (glyph_rect.min.y + src_offset.y + y - paint_rect.min.y + 1)*atlas.pitch +
+      glyph_rect.min.x + src_offset.x + 1;
+    Pixel *dest_row = screen.data + y*screen.pitch + paint_rect.min.x;
+
+    for (i32 x = 0; x < width; x += 8) {
+      i32_8x mask = mask_lt(lane_index + (f32)x, set8((f32)width));
+      V4_8x texel = pixel_u32_to_v4_8x(mask_load_i32_8x(src_row + x, mask));
+      V4_8x pixel = pixel_u32_to_v4_8x(mask_load_i32_8x(dest_row + x, mask));
+
+      V3_8x coverage;
+      if (lcd) {
+        coverage = texel.rgb*coverage_scale;
+      } else {
+        f32_8x a = texel.a*coverage_scale;
+        coverage = {a, a, a};
+      }
+
+      V3_8x pixel_linear = srgb255_to_linear1(pixel.rgb);
+      V3_8x blended = {
+        pixel_linear.r + (color_linear.r - pixel_linear.r)*coverage.r,
+        pixel_linear.g + (color_linear.g - pixel_linear.g)*coverage.g,
+        pixel_linear.b + (color_linear.b - pixel_linear.b)*coverage.b,
+      };
+      i32_8x result = pixel_v4_to_u32_8x(v4_8x(linear1_to_srgb255(blended), set8(255)));
+      mask_store_i32_8x(dest_row + x, mask, result);
+    }
+  }
+}
+
+struct Glyph_Placement {
+  V2i p;
+  Rect2i rect;
+};
+
+struct Text_Region_Task {
+  Rect2i region;
+  Bitmap screen;
+  Font *font;
+  Glyph_Placement *glyphs;
+  u32 glyph_count;
+  Pixel color;
+};
+
+void do_render_text_region_task(Text_Region_Task *task) {
+  for (u32 glyph_index = 0; glyph_index < task->glyph_count; glyph_index++) {
+    Glyph_Placement *glyph = task->glyphs + glyph_index;
+    draw_glyph_avx(task->screen, glyph->p, task->font->atlas.bmp, glyph->rect, task->color,
+                   task->region, task->font->lcd);
+  }
+}
+
+// p is the pen position of the first glyph, fractional x picks the subpixel phase
+void draw_text_threaded(Thread_Queue *queue, Bitmap screen, Font *font, char *text, V2 p, Pixel color) {
+  u32 text_length = (u32)strlen(text);
+  if (!text_length) return;
+
+  Mem_Size scratch_mark = scratch_get_mark();
+  Glyph_Placement *glyphs = (Glyph_Placement *)scratch_alloc(sizeof(Glyph_Placement)*text_length);
+
+  V2 pen = p;
+  for (u32 char_index = 0; char_index < text_length; char_index++) {
+    char c = text[char_index];
+    V2 glyph_min = pen + font->origins[font_get_char(font, c)];
+    f32 floor_x = floorf(glyph_min.x);
+    i32 phase = min((i32)((glyph_min.x - floor_x)*(f32)font->subpixel_phases), font->subpixel_phases - 1);
+
+    glyphs[char_index] = {
+      .p = {(i32)floor_x, (i32)floorf(glyph_min.y)},
+      .rect = font_get_glyph_rect(font, c, phase),
+    };
+
+    if (char_index != text_length - 1) {
+      pen.x += (f32)font_get_advance(font, c, text[char_index + 1]);
+    }
+  }
+
+#define REGION_COUNT 24
+  Text_Region_Task tasks[REGION_COUNT];
+  Rect2i screen_rect = {{0, 0}, {screen.width, screen.height}};
+  for (i32 region_index = 0; region_index < REGION_COUNT; region_index += 1) {
+    V2i region_size = {screen.width, screen.height/REGION_COUNT};
+    Rect2i region = rect2i_min_size({0, region_size.y*region_index}, region_size);
+    if (region_index == REGION_COUNT - 1) {
+      region.max.y = screen.height;
+    }
+
+    tasks[region_index] = {
+      .region = intersect(region, screen_rect),
+      .screen = screen,
+      .font = font,
+      .glyphs = glyphs,
+      .glyph_count = text_length,
+      .color = color,
+    };
+    add_thread_task(queue, (Worker_Fn)do_render_text_region_task, tasks + region_index);
+  }
+  wait_for_all_tasks(queue);
+#undef REGION_COUNT
+
+  scratch_set_mark(scratch_mark);
+}
+
 Bitmap win32_read_bmp(char *);
 globalvar Bitmap test_bmp;
 
 
-globalvar const char *GATE_AND = "and";
-globalvar const char *GATE_NOT = "not";
-globalvar const char *GATE_IN = "in";
-globalvar const char *GATE_OUT = "out";
+enum Gate_Op : u8 {
+  GATE_AND,
+  GATE_NOT,
+  // d, clock is implicit: q takes d on every circuit_step
+  GATE_DFF,
+  // d, enable: q follows d while enable is high, holds otherwise
+  GATE_LATCH,
+  GATE_IN,
+  GATE_OUT,
+  // owns children, the IN/OUT children stand for its pins
+  GATE_COMPOSITE,
+  // pins only, the children are the ones of its definition
+  GATE_INSTANCE,
+  // destroyed, the id waits on the free list
+  GATE_FREE,
+};
 
-struct Gate;
+typedef u32 Gate_Id;
+#define GATE_NONE 0xFFFFFFFF
 
-struct Pin {
-  bool ready;
-  bool value;
-  Gate *gate;
+// Gate_Id plus the generation of its slot, stops resolving once the gate
+// is destroyed even if make_gate hands the id out again
+struct Gate_Handle {
+  Gate_Id id;
+  u32 generation;
 };
 
-struct Gate {
-  const char *name;
-  Pin *pins;
-  u32 in_count;
-  u32 out_count;
+struct Netlist;
+
+// Gates are indices into parallel arrays, every gate has an entry in
+// each of them. Pins of all gates live in one pool:
+// pins of gate g are [pin_offsets[g], pin_offsets[g] + in_counts[g] + out_counts[g]),
+// inputs first.
+// Ids of destroyed gates stay GATE_FREE until make_gate reuses them, the
+// generations tell a Gate_Handle from before apart.
+struct Gate_Store {
+  u32 count;
+  u32 capacity;
+
+  u8 *ops;
+  u32 *in_counts;
+  u32 *out_counts;
+  u32 *pin_offsets;
+
+  // children of a composite, as a list in creation order
+  Gate_Id *parents;
+  Gate_Id *first_children;
+  Gate_Id *last_children;
+  Gate_Id *next_siblings;
+
+  // instances: their definition, definitions: compiled on first use.
+  // A compiled definition is current while its version matches
+  // edit_version, a current nullptr means it has a loop
+  Gate_Id *defs;
+  Netlist **def_netlists;
+  u32 *def_netlist_versions;
+  // bumped by every structural edit, before the edit's first compile
+  u32 edit_version;
+
+  // composite pins: the IN/OUT child standing for the pin
+  Gate_Id *pin_gates;
+  u32 pin_count;
+  u32 pin_capacity;
+
+  // bumped when a gate is destroyed
+  u32 *generations;
+  // destroyed gates, linked through next_siblings
+  Gate_Id free_head;
+  u32 free_count;
+
+  // the columns, and the layout's, always grow through this
+  Allocator allocator;
+  void *allocator_data;
+};
 
-  Gate **children;
-  V2 p;
+// editor only data, indexed like Gate_Store
+struct Gate_Layout {
+  V2 *positions;
+  const char **names;
 };
 
 struct Wire {
-  Gate *start;
+  Gate_Id start;
   u32 start_index;
 
-  Gate *end;
+  Gate_Id end;
   u32 end_index;
 };
 
+#define gate_for_children(gates, parent, child) \
+  for (Gate_Id child = (gates)->first_children[parent]; child != GATE_NONE; child = (gates)->next_siblings[child])
+
+#include "netlist.cpp"
+
 struct State {
-  Gate *gates;
-  Wire *wires;
+  Gate_Store gates;
+  Gate_Layout layout;
+  Slot_Map<Wire> wires;
+  Wire_Index wire_index;
 
-  Gate *drag_gate;
+  Circuit circuit;
+
+  // definitions built on first use, gate_nand etc. instance these
+  Gate_Id nand_def;
+  Gate_Id or_def;
+  Gate_Id xor_def;
+
+  Gate_Handle drag_gate;
 };
 
-Gate *make_gate(State *state, Gate *parent, const char *name, u32 ins, u32 outs) {
-  sb_push(state->gates, (Gate{}));
-  Gate *result = state->gates + sb_count(state->gates) - 1;
-  result->pins = sb_make(Pin, ins + outs);
-  result->in_count = ins;
-  result->out_count = outs;
-  result->name = name;
-
-  if (parent) {
-    if (!parent->children) {
-      parent->children = sb_make(Gate *, 32);
+void init_state(State *state) {
+  Context *ctx = get_context();
+  *state = {
+    .wires = make_slot_map<Wire>(64),
+    .nand_def = GATE_NONE,
+    .or_def = GATE_NONE,
+    .xor_def = GATE_NONE,
+  };
+  state->gates.allocator = ctx->allocator;
+  state->gates.allocator_data = ctx->allocator_data;
+}
+
+#define GROW_GATE_ARRAY(array, new_capacity) \
+  *(void **)&(array) = gates->allocator(Alloc_Op::REALLOC, sizeof(*(array))*(new_capacity), \
+                                        gates->allocator_data, array, 4*8)
+
+// makes room for gate_count more gates with pin_count more pins in total
+void reserve_gates(State *state, u32 gate_count, u32 pin_count) {
+  Gate_Store *gates = &state->gates;
+  Gate_Layout *layout = &state->layout;
+  if (gates->count + gate_count > gates->capacity) {
+    u32 capacity = max(gates->capacity*2, max(gates->count + gate_count, (u32)64));
+    GROW_GATE_ARRAY(gates->ops, capacity);
+    GROW_GATE_ARRAY(gates->in_counts, capacity);
+    GROW_GATE_ARRAY(gates->out_counts, capacity);
+    GROW_GATE_ARRAY(gates->pin_offsets, capacity);
+    GROW_GATE_ARRAY(gates->parents, capacity);
+    GROW_GATE_ARRAY(gates->first_children, capacity);
+    GROW_GATE_ARRAY(gates->last_children, capacity);
+    GROW_GATE_ARRAY(gates->next_siblings, capacity);
+    GROW_GATE_ARRAY(gates->defs, capacity);
+    GROW_GATE_ARRAY(gates->def_netlists, capacity);
+    GROW_GATE_ARRAY(gates->def_netlist_versions, capacity);
+    GROW_GATE_ARRAY(gates->generations, capacity);
+    GROW_GATE_ARRAY(layout->positions, capacity);
+    GROW_GATE_ARRAY(layout->names, capacity);
+    gates->capacity = capacity;
+  }
+  if (gates->pin_count + pin_count > gates->pin_capacity) {
+    u32 capacity = max(gates->pin_capacity*2, max(gates->pin_count + pin_count, (u32)256));
+    GROW_GATE_ARRAY(gates->pin_gates, capacity);
+    gates->pin_capacity = capacity;
+  }
+}
+
+#undef GROW_GATE_ARRAY
+
+// fills in a gate whose pins are already placed and links it under parent
+void init_gate(State *state, Gate_Id gate, Gate_Id parent, Gate_Op op, const char *name, u32 ins, u32 outs) {
+  Gate_Store *gates = &state->gates;
+  gates->edit_version++;
+  gates->ops[gate] = op;
+  gates->in_counts[gate] = ins;
+  gates->out_counts[gate] = outs;
+  for (u32 i = 0; i < ins + outs; i++) gates->pin_gates[gates->pin_offsets[gate] + i] = GATE_NONE;
+
+  gates->parents[gate] = parent;
+  gates->first_children[gate] = GATE_NONE;
+  gates->last_children[gate] = GATE_NONE;
+  gates->next_siblings[gate] = GATE_NONE;
+  gates->defs[gate] = GATE_NONE;
+  gates->def_netlists[gate] = nullptr;
+  gates->def_netlist_versions[gate] = 0;
+
+  state->layout.positions[gate] = {};
+  state->layout.names[gate] = name;
+
+  if (parent != GATE_NONE) {
+    if (gates->last_children[parent] == GATE_NONE) {
+      gates->first_children[parent] = gate;
+    } else {
+      gates->next_siblings[gates->last_children[parent]] = gate;
+    }
+    gates->last_children[parent] = gate;
+  }
+}
+
+// always takes a new id, consecutive appends get consecutive ids
+Gate_Id append_gate(State *state, Gate_Id parent, Gate_Op op, const char *name, u32 ins, u32 outs) {
+  reserve_gates(state, 1, ins + outs);
+  Gate_Store *gates = &state->gates;
+  Gate_Id result = gates->count++;
+  gates->generations[result] = 1;
+  gates->pin_offsets[result] = gates->pin_count;
+  gates->pin_count += ins + outs;
+  init_gate(state, result, parent, op, name, ins, outs);
+  return result;
+}
+
+// reuses the id of a destroyed gate, and its pins when they are enough
+Gate_Id make_gate(State *state, Gate_Id parent, Gate_Op op, const char *name, u32 ins, u32 outs) {
+  Gate_Store *gates = &state->gates;
+  Gate_Id result = GATE_NONE;
+  if (gates->free_count) {
+    result = gates->free_head;
+    gates->free_head = gates->next_siblings[result];
+    gates->free_count--;
+    if (ins + outs > gates->in_counts[result] + gates->out_counts[result]) {
+      reserve_gates(state, 0, ins + outs);
+      gates->pin_offsets[result] = gates->pin_count;
+      gates->pin_count += ins + outs;
     }
-    sb_push(parent->children, result);
+    init_gate(state, result, parent, op, name, ins, outs);
+  } else {
+    result = append_gate(state, parent, op, name, ins, outs);
   }
   return result;
 }
 
-Gate *gate_and(State *state, Gate *parent) {
-  Gate *result = make_gate(state, parent, GATE_AND, 2, 1);
+Gate_Handle gate_handle(Gate_Store *gates, Gate_Id gate) {
+  Gate_Handle result = {gate, gates->generations[gate]};
+  return result;
+}
+
+// GATE_NONE once the gate is destroyed, a zeroed handle never resolves
+Gate_Id gate_from_handle(Gate_Store *gates, Gate_Handle handle) {
+  Gate_Id result = GATE_NONE;
+  if (handle.id < gates->count && gates->generations[handle.id] == handle.generation &&
+      gates->ops[handle.id] != GATE_FREE) {
+    result = handle.id;
+  }
   return result;
 }
 
-Gate *gate_not(State *state, Gate *parent) {
-  Gate *result = make_gate(state, parent, GATE_NOT, 1, 1);
+Gate_Id make_composite(State *state, Gate_Id parent, const char *name, u32 ins, u32 outs) {
+  Gate_Id result = make_gate(state, parent, GATE_COMPOSITE, name, ins, outs);
   return result;
 }
 
-Gate *gate_in(State *state, Gate *parent, u32 in) {
-  Gate *result = make_gate(state, parent, GATE_IN, 0, 1);
-  parent->pins[in].gate = result;
+Gate_Id gate_instance(State *state, Gate_Id parent, Gate_Id def) {
+  Gate_Store *gates = &state->gates;
+  Gate_Id result = make_gate(state, parent, GATE_INSTANCE, state->layout.names[def],
+                             gates->in_counts[def], gates->out_counts[def]);
+  gates->defs[result] = def;
   return result;
 }
 
-Gate *gate_out(State *state, Gate *parent, u32 out) {
-  Gate *result = make_gate(state, parent, GATE_OUT, 1, 0);
-  parent->pins[parent->in_count + out].gate = result;
+Gate_Id gate_and(State *state, Gate_Id parent) {
+  Gate_Id result = make_gate(state, parent, GATE_AND, "and", 2, 1);
   return result;
 }
 
-void connect(State *state, Wire wire) {
-  sb_push(state->wires, wire);
+Gate_Id gate_not(State *state, Gate_Id parent) {
+  Gate_Id result = make_gate(state, parent, GATE_NOT, "not", 1, 1);
+  return result;
 }
 
-bool contains(Gate **gates, Gate *element) {
-  bool result = false;
-  for (u32 i = 0; i < sb_count(gates); i++) {
-    if (gates[i] == element) {
-      result = true;
-      break;
-    }
+Gate_Id gate_dff(State *state, Gate_Id parent) {
+  Gate_Id result = make_gate(state, parent, GATE_DFF, "dff", 1, 1);
+  return result;
+}
+
+Gate_Id gate_latch(State *state, Gate_Id parent) {
+  Gate_Id result = make_gate(state, parent, GATE_LATCH, "latch", 2, 1);
+  return result;
+}
+
+Gate_Id gate_in(State *state, Gate_Id parent, u32 in) {
+  Gate_Id result = make_gate(state, parent, GATE_IN, "in", 0, 1);
+  state->gates.pin_gates[state->gates.pin_offsets[parent] + in] = result;
+  return result;
+}
+
+Gate_Id gate_out(State *state, Gate_Id parent, u32 out) {
+  Gate_Id result = make_gate(state, parent, GATE_OUT, "out", 1, 0);
+  Gate_Store *gates = &state->gates;
+  gates->pin_gates[gates->pin_offsets[parent] + gates->in_counts[parent] + out] = result;
+  return result;
+}
+
+// connect and disconnect keep a current wire index up to date
+Handle connect(State *state, Wire wire) {
+  Slot_Map<Wire> *wires = &state->wires;
+  Gate_Store *gates = &state->gates;
+  gates->edit_version++;
+  bool indexed = wire_index_is_current(&state->wire_index, gates->count, wires->items.data, wires->items.count,
+                                       wires->version);
+  Handle result = slot_map_add(wires, wire);
+  if (indexed) {
+    wire_index_add(&state->wire_index, gates->count, wires->items.data, wires->items.count, wires->version);
   }
   return result;
 }
 
-bool in_connected(State *state, Gate *gate, u32 in_index) {
-  bool result = false;
-  for (u32 i = 0; i < sb_count(state->wires); i++) {
-    if (state->wires[i].end == gate && state->wires[i].end_index == in_index) {
-      result = true;
-      break;
+bool disconnect(State *state, Handle handle) {
+  Slot_Map<Wire> *wires = &state->wires;
+  Gate_Store *gates = &state->gates;
+  Wire *wire = slot_map_get(wires, handle);
+  if (wire) {
+    gates->edit_version++;
+    bool indexed = wire_index_is_current(&state->wire_index, gates->count, wires->items.data, wires->items.count,
+                                         wires->version);
+    Wire removed = *wire;
+    u32 w = (u32)(wire - wires->items.data);
+    slot_map_remove_at(wires, w);
+    if (indexed) {
+      wire_index_remove(&state->wire_index, removed, w, wires->items.data, wires->items.count, wires->version);
     }
   }
-  return result;
+  return wire != nullptr;
 }
 
-void set_pin(Gate *gate, u32 pin_index, bool value) {
-  gate->pins[pin_index].value = value;
-  gate->pins[pin_index].ready = true;
+Wire_Index *get_wire_index(State *state) {
+  wire_index_update(&state->wire_index, state->gates.count, state->wires.items.data, state->wires.items.count,
+                    state->wires.version);
+  return &state->wire_index;
 }
 
-bool *run(State *state, Gate *gate) {
-#define INS(g, n) (g)->pins[n]
-#define OUTS(g, n) (g)->pins[(g)->in_count + (n)]
+bool gate_in_tree(Gate_Store *gates, Gate_Id gate, Gate_Id root) {
+  while (gate != GATE_NONE && gate != root) gate = gates->parents[gate];
+  return gate == root;
+}
 
-  if (gate->children) {
-    for (u32 child_index = 0; child_index < sb_count(gate->children); child_index++) {
-      Gate *child = gate->children[child_index];
-      for (u32 in_index = 0; in_index < child->in_count; in_index++) {
-        INS(child, in_index).ready = false;
-      }
+// false while a gate outside the tree under gate instances a definition in it
+bool gate_can_destroy(Gate_Store *gates, Gate_Id gate) {
+  bool result = true;
+  for (Gate_Id g = 0; g < gates->count && result; g++) {
+    if (gates->ops[g] == GATE_INSTANCE && gate_in_tree(gates, gates->defs[g], gate) &&
+        !gate_in_tree(gates, g, gate)) {
+      result = false;
     }
   }
+  return result;
+}
 
-  bool *result = sb_make(bool, gate->out_count);
+void free_gate_tree(Gate_Store *gates, Gate_Id gate) {
+  Gate_Id child = gates->first_children[gate];
+  while (child != GATE_NONE) {
+    Gate_Id next = gates->next_siblings[child];
+    free_gate_tree(gates, child);
+    child = next;
+  }
+  if (gates->def_netlists[gate]) {
+    netlist_free(gates->def_netlists[gate]);
+    memfree(gates->def_netlists[gate]);
+    gates->def_netlists[gate] = nullptr;
+  }
+  gates->ops[gate] = GATE_FREE;
+  gates->generations[gate]++;
+  gates->next_siblings[gate] = gates->free_count ? gates->free_head : GATE_NONE;
+  gates->free_head = gate;
+  gates->free_count++;
+}
 
-  if (gate->name == GATE_AND) {
-    OUTS(gate, 0).value = INS(gate, 0).value && INS(gate, 1).value;
-  } else if (gate->name == GATE_NOT) {
-    OUTS(gate, 0).value = !INS(gate, 0).value;
-  } else if (gate->name != GATE_IN && gate->name != GATE_OUT) {
-    for (u32 in_index = 0; in_index < gate->in_count; in_index++) {
-      Pin in = INS(gate, in_index);
-      OUTS(in.gate, 0).value = in.value;
-      run(state, in.gate);
+// Unlinks gate from its parent and frees it and everything under it,
+// wires touching any of them are removed. Compiled definitions go
+// stale, the circuit has to be compiled again. A definition that is
+// still instanced must not be destroyed, see gate_can_destroy.
+void destroy_gate(State *state, Gate_Id gate) {
+  Gate_Store *gates = &state->gates;
+  assert(gates->ops[gate] != GATE_FREE);
+  assert(gate_can_destroy(gates, gate));
+  gates->edit_version++;
+  Gate_Id parent = gates->parents[gate];
+  if (parent != GATE_NONE) {
+    Gate_Id prev = GATE_NONE;
+    gate_for_children(gates, parent, child) {
+      if (child == gate) break;
+      prev = child;
+    }
+    Gate_Id next = gates->next_siblings[gate];
+    if (prev == GATE_NONE) {
+      gates->first_children[parent] = next;
+    } else {
+      gates->next_siblings[prev] = next;
     }
-    // TODO: run all child gates that do not have any ins
+    if (gates->last_children[parent] == gate) gates->last_children[parent] = prev;
 
-    for (u32 out_index = 0; out_index < state->gates->out_count; out_index++) {
-      Pin *pin = &OUTS(gate, out_index);
-      pin->value = INS(pin->gate, 0).value;
+    // an IN/OUT child leaves its pin unconnected
+    u32 first = gates->pin_offsets[parent];
+    for (u32 i = 0; i < gates->in_counts[parent] + gates->out_counts[parent]; i++) {
+      if (gates->pin_gates[first + i] == gate) gates->pin_gates[first + i] = GATE_NONE;
     }
   }
-  
-  for (u32 out_index = 0; out_index < gate->out_count; out_index++) {
-    result[out_index] = OUTS(gate, out_index).value;
-
-    for (u32 wire_index = 0; wire_index < sb_count(state->wires); wire_index++) {
-      Wire *w = state->wires + wire_index;
-      if (w->start == gate) {
-        Pin *start_pin = &OUTS(gate, out_index);
-        set_pin(w->end, w->end_index, start_pin->value);
-
-        bool all_pins_ready = true;
-        for (u32 end_in_index = 0; end_in_index < w->end->in_count; end_in_index++) {
-          if (in_connected(state, w->end, end_in_index) && !INS(w->end, end_in_index).ready) {
-            all_pins_ready = false;
-            break;
-          }
-        }
-        if (all_pins_ready) {
-          run(state, w->end);
-        }
-      }
+  free_gate_tree(gates, gate);
+
+  // from the back, so the wire moved into a hole was already checked
+  Slot_Map<Wire> *wires = &state->wires;
+  for (u32 w = wires->items.count; w-- > 0;) {
+    Wire wire = wires->items[w];
+    if (gates->ops[wire.start] == GATE_FREE || gates->ops[wire.end] == GATE_FREE) {
+      slot_map_remove_at(wires, w);
     }
   }
-
-  return result;
-
-#undef INS
-#undef OUTS
 }
 
-Gate *gate_nand(State *state, Gate *parent) {
-  Gate *nand = make_gate(state, parent, "nand", 2, 1);
-  Gate *a = gate_in(state, nand, 0);
-  a->p = {100, 100};
-
-  Gate *b = gate_in(state, nand, 1);
-  b->p = {100, 200};
+Gate_Id gate_nand(State *state, Gate_Id parent);
+Gate_Id gate_or(State *state, Gate_Id parent);
 
-  Gate *out = gate_out(state, nand, 0);
+Gate_Id get_nand_def(State *state) {
+  if (state->nand_def != GATE_NONE) return state->nand_def;
 
-  Gate *_and = gate_and(state, nand);
-  _and->p = {200, 150};
+  Gate_Id nand = make_composite(state, GATE_NONE, "nand", 2, 1);
+  Gate_Id a = gate_in(state, nand, 0);
+  Gate_Id b = gate_in(state, nand, 1);
+  Gate_Id out = gate_out(state, nand, 0);
+  Gate_Id _and = gate_and(state, nand);
+  Gate_Id _not = gate_not(state, nand);
 
-  Gate *_not = gate_not(state, nand);
-  _not->p = {300, 150};
-
-  out->p = {400, 150};
+  V2 *positions = state->layout.positions;
+  positions[a] = {100, 100};
+  positions[b] = {100, 200};
+  positions[_and] = {200, 150};
+  positions[_not] = {300, 150};
+  positions[out] = {400, 150};
 
   connect(state, { a, 0, _and, 0 });
   connect(state, { b, 0, _and, 1 });
   connect(state, { _and, 0, _not, 0 });
   connect(state, { _not, 0, out, 0 });
 
+  state->nand_def = nand;
   return nand;
 }
 
-Gate *gate_or(State *state, Gate *parent) {
-  Gate *result = make_gate(state, parent, "or", 2, 1);
-  Gate *a = gate_in(state, result, 0);
-  Gate *b = gate_in(state, result, 1);
-  Gate *out = gate_out(state, result, 0);
+Gate_Id get_or_def(State *state) {
+  if (state->or_def != GATE_NONE) return state->or_def;
+
+  Gate_Id result = make_composite(state, GATE_NONE, "or", 2, 1);
+  Gate_Id a = gate_in(state, result, 0);
+  Gate_Id b = gate_in(state, result, 1);
+  Gate_Id out = gate_out(state, result, 0);
 
-  Gate *nand = gate_nand(state, result);
-  Gate *not_a = gate_not(state, result);
-  Gate *not_b = gate_not(state, result);
+  Gate_Id nand = gate_nand(state, result);
+  Gate_Id not_a = gate_not(state, result);
+  Gate_Id not_b = gate_not(state, result);
 
   connect(state, { a, 0, not_a, 0 });
   connect(state, { b, 0, not_b, 0 });
@@ -710,18 +1326,21 @@ Gate *gate_or(State *state, Gate *parent) {
   connect(state, { not_b, 0, nand, 1 });
   connect(state, { nand, 0, out, 0 });
 
+  state->or_def = result;
   return result;
 }
 
-Gate *gate_xor(State *state, Gate *parent) {
-  Gate *result = make_gate(state, parent, "xor", 2, 1);
-  Gate *a = gate_in(state, result, 0);
-  Gate *b = gate_in(state, result, 1);
-  Gate *out = gate_out(state, result, 0);
+Gate_Id get_xor_def(State *state) {
+  if (state->xor_def != GATE_NONE) return state->xor_def;
 
-  Gate *nand = gate_nand(state, result);
-  Gate *_or = gate_or(state, result);
-  Gate *_and = gate_and(state, result);
+  Gate_Id result = make_composite(state, GATE_NONE, "xor", 2, 1);
+  Gate_Id a = gate_in(state, result, 0);
+  Gate_Id b = gate_in(state, result, 1);
+  Gate_Id out = gate_out(state, result, 0);
+
+  Gate_Id nand = gate_nand(state, result);
+  Gate_Id _or = gate_or(state, result);
+  Gate_Id _and = gate_and(state, result);
 
   connect(state, {a, 0, nand, 0});
   connect(state, {b, 0, nand, 1});
@@ -731,12 +1350,30 @@ Gate *gate_xor(State *state, Gate *parent) {
   connect(state, {_or, 0, _and, 1});
   connect(state, {_and, 0, out, 0});
 
+  state->xor_def = result;
+  return result;
+}
+
+Gate_Id gate_nand(State *state, Gate_Id parent) {
+  Gate_Id result = gate_instance(state, parent, get_nand_def(state));
+  return result;
+}
+
+Gate_Id gate_or(State *state, Gate_Id parent) {
+  Gate_Id result = gate_instance(state, parent, get_or_def(state));
   return result;
 }
 
-V2 get_gate_size(Gate *gate) {
+Gate_Id gate_xor(State *state, Gate_Id parent) {
+  Gate_Id result = gate_instance(state, parent, get_xor_def(state));
+  return result;
+}
+
+#include "netlist_io.cpp"
+
+V2 get_gate_size(Gate_Op op) {
   V2 size;
-  if (gate->name == GATE_IN || gate->name == GATE_OUT) {
+  if (op == GATE_IN || op == GATE_OUT) {
     size = {20, 20};
   } else {
     size = {20, 40};
@@ -744,9 +1381,9 @@ V2 get_gate_size(Gate *gate) {
   return size;
 }
 
-Pixel get_gate_color(Gate *gate) {
+Pixel get_gate_color(Gate_Op op) {
   Pixel color;
-  if (gate->name == GATE_IN || gate->name == GATE_OUT) {
+  if (op == GATE_IN || op == GATE_OUT) {
     color = GREEN;
   } else {
     color = PINK;
@@ -754,114 +1391,180 @@ Pixel get_gate_color(Gate *gate) {
   return color;
 }
 
-V2 get_input_p(Gate *gate, u32 index) {
-  V2 size = get_gate_size(gate);
-  f32 interval = size.y/(f32)(gate->in_count);
-  V2 result = gate->p - size*0.5f + V2{0, (index + 0.5f)*interval};
+V2 get_input_p(State *state, Gate_Id gate, u32 index) {
+  V2 size = get_gate_size((Gate_Op)state->gates.ops[gate]);
+  f32 interval = size.y/(f32)(state->gates.in_counts[gate]);
+  V2 result = state->layout.positions[gate] - size*0.5f + V2{0, (index + 0.5f)*interval};
   return result;
 }
-V2 get_output_p(Gate *gate, u32 index) {
-  V2 size = get_gate_size(gate);
-  f32 interval = size.y/(f32)(gate->out_count);
-  V2 result = gate->p + size*0.5f - V2{0, (index + 0.5f)*interval};
+V2 get_output_p(State *state, Gate_Id gate, u32 index) {
+  V2 size = get_gate_size((Gate_Op)state->gates.ops[gate]);
+  f32 interval = size.y/(f32)(state->gates.out_counts[gate]);
+  V2 result = state->layout.positions[gate] + size*0.5f - V2{0, (index + 0.5f)*interval};
   return result;
 }
 
-void draw_gate_scheme(Thread_Queue *queue, Input input, Bitmap screen, State *state, Gate *gate) {
-  if (state->drag_gate) {
-    state->drag_gate->p = input.mouse.p;
+// a white texel inside the 1px apron bitmaps have, tinted into every rect
+// and line of the scheme
+globalvar Pixel _white_texels[9] = {{0}, {0}, {0}, {0}, {0xFFFFFFFF}, {0}, {0}, {0}, {0}};
+
+void push_scheme_rect(Array<Sprite> *sprites, Array<Vertex_Colors> *colors, V2 p, V2 size, Vertex_Colors color) {
+  array_push(sprites, {.p = p, .size = size, .tint = color.c00});
+  array_push(colors, color);
+}
+
+void push_scheme_line(Array<Sprite> *sprites, Array<Vertex_Colors> *colors, V2 start, V2 end, f32 thickness,
+                      Pixel color) {
+  V2 line = end - start;
+  array_push(sprites, {.p = start + line*0.5f, .size = {len(line), thickness}, .angle = get_angle(line), .tint = color});
+  array_push(colors, vertex_colors(color));
+}
+
+void draw_gate_scheme(Thread_Queue *queue, Input input, Bitmap screen, State *state, Gate_Id gate) {
+  Gate_Store *gates = &state->gates;
+  V2 *positions = state->layout.positions;
+  Gate_Id drag_gate = gate_from_handle(gates, state->drag_gate);
+  if (drag_gate != GATE_NONE) {
+    positions[drag_gate] = input.mouse.p;
 
     if (input.mouse.left.went_up) {
-      state->drag_gate = nullptr;
+      state->drag_gate = {};
     }
   }
 
-  for (u32 child_index = 0; child_index < sb_count(gate->children); child_index++) {
-    Gate *child = gate->children[child_index];
-    Pixel color = get_gate_color(child);
-    V2 size = get_gate_size(child);
+  // right click cuts the wire into the pin under the mouse, or else
+  // destroys the gate under it, once the index is no longer in use.
+  // the scheme's own IN/OUT gates stay, they stand for its pins
+  Handle cut_wire = {};
+  Gate_Id destroyed_gate = GATE_NONE;
+
+  // the whole scheme is one sprite batch, in the order it used to be
+  // drawn. Only the arrays are frame memory, edits below allocate as usual
+  Array<Sprite> sprites;
+  Array<Vertex_Colors> colors;
+  {
+    Context_Scope frame_scope = push_context(Frame_Lifetime::THIS_FRAME);
+    sprites = make_array<Sprite>(64);
+    colors = make_array<Vertex_Colors>(64);
+  }
 
-    Rect2 rect = rect2_center_size(child->p, size);
+  Wire_Index *wire_index = get_wire_index(state);
+  gate_for_children(gates, gate, child) {
+    Gate_Op op = (Gate_Op)gates->ops[child];
+    Pixel color = get_gate_color(op);
+    V2 size = get_gate_size(op);
+
+    Rect2 rect = rect2_center_size(positions[child], size);
     bool mouse_over = point_in_rect(rect, input.mouse.p);
 
-    draw_rect_threaded(queue, {
-      .screen = screen,
-      .p = child->p,
-      .size = size,
-      .color = mouse_over ? WHITE : color
-    });
-
-    for (u32 wire_index = 0; wire_index < sb_count(state->wires); wire_index++) {
-      Wire *w = state->wires + wire_index;
-      if (w->start == child) {
-        draw_line_threaded(queue, {
-          .screen = screen,
-          .start = get_output_p(child, w->start_index),
-          .end = get_input_p(w->end, w->end_index),
-          .thickness = 3,
-          .color = w->end->pins[w->end_index].value ? RED : BLACK
-        });
+    // shaded darker towards the bottom, y is up
+    Pixel top = mouse_over ? WHITE : color;
+    Pixel bottom = lerp(top, BLACK, 0.35f);
+    push_scheme_rect(&sprites, &colors, positions[child], size, {bottom, bottom, top, top});
+
+    Wire_List fanout = wire_index_fanout(wire_index, child);
+    for (u32 i = 0; i < fanout.count; i++) {
+      Wire *w = &state->wires.items[fanout.indices[i]];
+      V2 end = get_input_p(state, w->end, w->end_index);
+      if (input.mouse.right.went_down && len_sqr(input.mouse.p - end) < 5*5) {
+        cut_wire = slot_map_handle_at(&state->wires, fanout.indices[i]);
       }
+      push_scheme_line(&sprites, &colors, get_output_p(state, child, w->start_index), end, 3,
+                       circuit_get_pin(&state->circuit, w->end, w->end_index) ? RED : BLACK);
     }
 
     if (mouse_over && input.mouse.left.went_down) {
-      state->drag_gate = child;
+      state->drag_gate = gate_handle(gates, child);
     }
+    if (mouse_over && input.mouse.right.went_down && op != GATE_IN && op != GATE_OUT) {
+      destroyed_gate = child;
+    }
+  }
+
+  bool edited = disconnect(state, cut_wire);
+  if (!edited && destroyed_gate != GATE_NONE && gate_can_destroy(gates, destroyed_gate)) {
+    destroy_gate(state, destroyed_gate);
+    edited = true;
+  }
+  if (edited) {
+    // removing wires and gates can't close a loop
+    circuit_free(&state->circuit);
+    Circuit_Compile_Result compiled = circuit_compile(gates, state->wires.items.data, state->wires.items.count,
+                                                      gate, &state->circuit);
+    assert(compiled == CIRCUIT_COMPILE_OK);
+    circuit_eval(&state->circuit);
   }
 
-  for (u32 in_index = 0; in_index < gate->in_count; in_index++) {
-    Pin pin = gate->pins[in_index];
-    Gate *in = pin.gate;
-    V2 size = get_gate_size(in);
-    Rect2 rect = rect2_center_size(in->p, size);
+  for (u32 in_index = 0; in_index < gates->in_counts[gate]; in_index++) {
+    Gate_Id in = gates->pin_gates[gates->pin_offsets[gate] + in_index];
+    V2 size = get_gate_size(GATE_IN);
+    Rect2 rect = rect2_center_size(positions[in], size);
     bool mouse_over = point_in_rect(rect, input.mouse.p);
     if (mouse_over && input.mouse.left.went_up) {
-      set_pin(gate, in_index, !pin.value);
-      run(state, gate);
+      circuit_change_input(&state->circuit, in_index, !circuit_get_input(&state->circuit, in_index));
+      circuit_propagate(&state->circuit);
     }
   }
 
-  for (u32 child_index = 0; child_index < sb_count(gate->children); child_index++) {
-    Gate *child = gate->children[child_index];
-
-    for (u32 in_index = 0; in_index < child->in_count; in_index++) {
-      draw_rect_threaded(queue, {
-        .screen = screen,
-        .p = get_input_p(child, in_index),
-        .size = {5, 5},
-        .color = YELLOW
-      });
+  gate_for_children(gates, gate, child) {
+    for (u32 in_index = 0; in_index < gates->in_counts[child]; in_index++) {
+      push_scheme_rect(&sprites, &colors, get_input_p(state, child, in_index), {5, 5}, vertex_colors(YELLOW));
     }
-    for (u32 out_index = 0; out_index < child->out_count; out_index++) {
-      draw_rect_threaded(queue, {
-        .screen = screen,
-        .p = get_output_p(child, out_index),
-        .size = {5, 5},
-        .color = YELLOW
-      });
+    for (u32 out_index = 0; out_index < gates->out_counts[child]; out_index++) {
+      push_scheme_rect(&sprites, &colors, get_output_p(state, child, out_index), {5, 5}, vertex_colors(YELLOW));
     }
   }
+
+  Bitmap white = {.width = 1, .height = 1, .pitch = 3, .data = _white_texels};
+  draw_sprites_threaded(queue, screen, white, sprites.data, sprites.count, colors.data);
 }
 
 globalvar State _state = {};
-globalvar Gate *nand;
+globalvar Gate_Id nand;
+// the game's own allocations, mostly small ones that churn with every
+// edit (definition netlists, names, index and slot arrays). Bigger ones
+// fall through to whatever allocator the platform layer pushed. Only the
+// main thread allocates and frees under it, tasks use their scratch and
+// frame arenas.
+globalvar Pool _game_pool;
 
 void game_update(Bitmap screen, Input input, Thread_Queue *thread_queue, Font *font) {
   State *state = &_state;
-
+#ifndef LVL5_TRACK_ALLOCATIONS
+  // pooled blocks never reach the allocator below, so with the tracker in
+  // place everything goes straight to it and the leak report sees it all
+  if (!_game_pool.slabs.data) {
+    Context *ctx = get_context();
+    _game_pool = make_pool(gigabytes(1), ctx->allocator, ctx->allocator_data);
+  }
+  Context_Scope pool_scope = push_context(&_game_pool);
+#endif
 
   if (!loaded) {
     loaded = true;
     test_bmp = win32_read_bmp("test.bmp");
 
-    _state.gates = sb_make(Gate, 64);
-    _state.wires = sb_make(Wire, 64);
-    nand = gate_nand(&_state, nullptr);
-
-    set_pin(nand, 1, false);
-    set_pin(nand, 0, false);
-
-    run(state, nand);
+    init_state(&_state);
+    nand = get_nand_def(&_state);
+
+    Circuit_Compile_Result compiled = circuit_compile(&state->gates, state->wires.items.data, state->wires.items.count,
+                                                      nand, &state->circuit);
+    assert(compiled == CIRCUIT_COMPILE_OK);
+
+    Netlist_Optimize_Stats optimized;
+    circuit_optimize(&state->circuit, &optimized);
+#ifdef NETLIST_BENCHMARK
+    char buffer[256];
+    sprintf_s(buffer, array_count(buffer), "netlist: %u and, %u not, %u levels -> %u and, %u not, %u levels\n",
+             (unsigned)optimized.and_count_before, (unsigned)optimized.not_count_before,
+             (unsigned)optimized.level_count_before, (unsigned)optimized.and_count_after,
+             (unsigned)optimized.not_count_after, (unsigned)optimized.level_count_after);
+    OutputDebugStringA(buffer);
+#endif
+
+    circuit_set_input(&state->circuit, 1, false);
+    circuit_set_input(&state->circuit, 0, false);
+    circuit_eval(&state->circuit);
   }
 
 
@@ -870,25 +1573,7 @@ void game_update(Bitmap screen, Input input, Thread_Queue *thread_queue, Font *f
   f32 scale = (sinf(t) + 1)*10 + 10;
   memset(screen.data, (i32)0xFF333333, (size_t)((u32)screen.height*(u32)screen.pitch*sizeof(Pixel)));
 
-  // draw_gate_scheme(thread_queue, input, screen, state, nand);
+  draw_gate_scheme(thread_queue, input, screen, state, nand);
   char foo[] = "stop this shit";
-  V2 offset = {};
-  for (u32 char_index = 0; char_index < array_count(foo); char_index++) {
-    char c = foo[char_index];
-    Rect2i letter_rect = font->atlas.rects[c];
-    V2 size = v2(get_size(letter_rect));
-    V2 origin = font->origins[c];
-    draw_bitmap_threaded(thread_queue, {
-      .screen = screen,
-      .p = V2{100, 400} + (offset + size*0.5 + origin),
-      .size = size,
-      .bmp = font->atlas.bmp,
-      .sprite_rect = letter_rect,
-    });
-
-    if (char_index != array_count(foo) - 1) {
-      i8 advance = font_get_advance(font, foo[char_index], foo[char_index+1]);
-      offset.x += (f32)advance;
-    }
-  }
+  draw_text_threaded(thread_queue, screen, font, foo, V2{100, 400}, WHITE);
 }
@@ -5,12 +5,204 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 struct Arena {
   byte *data;
   Mem_Size size;
+  // bytes usable right now, a reserved arena commits more on demand
   Mem_Size capacity;
+
+  // virtual range owned by the arena, 0 for a fixed block
+  Mem_Size reserved;
+  // committed bytes past this are returned to the os by arena_reset
+  Mem_Size high_water;
+  Mem_Size commit_granularity;
+
+  // offset of the newest allocation, REALLOC grows it in place
+  Mem_Size last_offset;
+  // highest size reached, for telemetry, reset by whoever reads it
+  Mem_Size peak;
 };
 
+// NOTE: thin wrappers over the os virtual memory calls,
+// addresses and sizes are page aligned
+void *os_reserve(Mem_Size size, bool huge_pages) {
+#if defined(_WIN32)
+  void *result = nullptr;
+  if (huge_pages) {
+    // large pages can't be committed on demand, the whole range is committed
+    // and locked here, which needs SeLockMemoryPrivilege
+    result = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  }
+  if (!result) {
+    result = VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+  }
+#else
+  void *result = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (result == MAP_FAILED) {
+    result = nullptr;
+  }
+#if defined(MADV_HUGEPAGE)
+  if (result && huge_pages) {
+    madvise(result, size, MADV_HUGEPAGE);
+  }
+#endif
+#endif
+  return result;
+}
+
+bool os_commit(void *ptr, Mem_Size size) {
+#if defined(_WIN32)
+  bool result = VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+  bool result = mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+#endif
+  return result;
+}
+
+void os_decommit(void *ptr, Mem_Size size) {
+#if defined(_WIN32)
+  VirtualFree(ptr, size, MEM_DECOMMIT);
+#else
+  madvise(ptr, size, MADV_DONTNEED);
+  mprotect(ptr, size, PROT_NONE);
+#endif
+}
+
+void os_release(void *ptr, Mem_Size size) {
+#if defined(_WIN32)
+  VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+  munmap(ptr, size);
+#endif
+}
+
+Mem_Size os_page_size(bool huge_pages) {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  Mem_Size result = info.dwAllocationGranularity;
+  if (huge_pages && GetLargePageMinimum()) {
+    result = GetLargePageMinimum();
+  }
+#else
+  Mem_Size result = huge_pages ? megabytes(2) : (Mem_Size)sysconf(_SC_PAGESIZE);
+#endif
+  return result;
+}
+
+// NOTE: full barrier atomics for the few counters threads share,
+// both return the value from before the operation
+Mem_Size atomic_add(volatile Mem_Size *value, Mem_Size addend) {
+#if defined(_WIN32)
+  Mem_Size result = (Mem_Size)InterlockedExchangeAdd64((volatile LONG64 *)value, (LONG64)addend);
+#else
+  Mem_Size result = __atomic_fetch_add(value, addend, __ATOMIC_SEQ_CST);
+#endif
+  return result;
+}
+
+u32 atomic_compare_exchange(volatile u32 *value, u32 new_value, u32 expected) {
+#if defined(_WIN32)
+  u32 result = (u32)InterlockedCompareExchange((volatile LONG *)value, (LONG)new_value, (LONG)expected);
+#else
+  u32 result = expected;
+  __atomic_compare_exchange_n(value, &result, new_value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+  return result;
+}
+
+Mem_Size align_up(Mem_Size value, Mem_Size align) {
+  Mem_Size result = value;
+  if (result % align != 0) {
+    result += align - result % align;
+  }
+  return result;
+}
+
+#define ARENA_DEFAULT_HIGH_WATER megabytes(4)
+
+// Reserves address space only, pages are committed as allocations reach
+// them and stay contiguous, so the arena never moves.
+Arena make_arena(Mem_Size reserve_size, bool huge_pages = false) {
+  Mem_Size granularity = os_page_size(huge_pages);
+  if (granularity < kilobytes(64)) {
+    granularity = kilobytes(64);
+  }
+  Mem_Size reserved = align_up(reserve_size, granularity);
+  Arena result = {
+    .data = (byte *)os_reserve(reserved, huge_pages),
+    .reserved = reserved,
+    .high_water = ARENA_DEFAULT_HIGH_WATER,
+    .commit_granularity = granularity,
+  };
+  assert(result.data);
+#if defined(_WIN32)
+  // large pages came back committed
+  MEMORY_BASIC_INFORMATION info;
+  if (huge_pages && VirtualQuery(result.data, &info, sizeof(info)) && info.State == MEM_COMMIT) {
+    result.capacity = reserved;
+    result.high_water = reserved;
+  }
+#endif
+  return result;
+}
+
+// Arena over a caller owned block, allocations past capacity fail.
+Arena make_arena(void *data, Mem_Size capacity) {
+  Arena result = {
+    .data = (byte *)data,
+    .capacity = capacity,
+  };
+  return result;
+}
+
+void free_arena(Arena *arena) {
+  if (arena->reserved) {
+    os_release(arena->data, arena->reserved);
+  }
+  *arena = {};
+}
+
+// Makes [0, size) usable, false if size is past the end of the arena.
+bool arena_ensure_committed(Arena *arena, Mem_Size size) {
+  bool result = size <= arena->capacity;
+  if (!result && size <= arena->reserved) {
+    Mem_Size new_capacity = align_up(size, arena->commit_granularity);
+    if (new_capacity > arena->reserved) {
+      new_capacity = arena->reserved;
+    }
+    result = os_commit(arena->data + arena->capacity, new_capacity - arena->capacity);
+    if (result) {
+      arena->capacity = new_capacity;
+    }
+  }
+  return result;
+}
+
+// Frees everything, committed pages past high_water go back to the os so
+// one huge frame doesn't pin its memory for the rest of the run.
+void arena_reset(Arena *arena) {
+  arena->size = 0;
+  arena->last_offset = 0;
+  if (arena->reserved && arena->capacity > arena->high_water) {
+    Mem_Size keep = align_up(arena->high_water, arena->commit_granularity);
+    if (keep < arena->capacity) {
+      os_decommit(arena->data + keep, arena->capacity - keep);
+      arena->capacity = keep;
+    }
+  }
+}
+
 enum class Alloc_Op {
   ALLOC,
   FREE,
@@ -51,16 +243,13 @@ void *heap_allocator(Alloc_Op op, Mem_Size size, void *allocator_data, void *old
 }
 
 
-#define __DEFAULT_SCRATCH_CAPACITY kilobytes(40)
+#define __DEFAULT_SCRATCH_RESERVE gigabytes(1)
 globalvar thread_local Arena __global_default_scratch;
 globalvar thread_local Context __global_context_stack[16];
 globalvar thread_local u32 __global_context_count = 0;
 
 void init_default_context() {
-  __global_default_scratch = {
-    .data = (byte *)_aligned_malloc(__DEFAULT_SCRATCH_CAPACITY, 16),
-    .capacity = __DEFAULT_SCRATCH_CAPACITY,
-  };
+  __global_default_scratch = make_arena(__DEFAULT_SCRATCH_RESERVE);
 
   __global_context_stack[__global_context_count++] = {
     .allocator = heap_allocator,
@@ -87,46 +276,605 @@ void *arena_allocator(Alloc_Op op, Mem_Size size, void *allocator_data, void *ol
 
   switch (op) {
     case Alloc_Op::ALLOC: {
-      Mem_Size aligned_size = size;
-      if (aligned_size % align != 0) {
-          aligned_size += align - aligned_size % align;
+      Mem_Size aligned_size = align_up(size, align);
+      Mem_Size start = align_up((Mem_Size)arena->data + arena->size, align) - (Mem_Size)arena->data;
+      bool fits = arena_ensure_committed(arena, start + aligned_size);
+      assert(fits);
+      if (fits) {
+        result = arena->data + start;
+        arena->last_offset = start;
+        arena->size = start + aligned_size;
+        if (arena->size > arena->peak) arena->peak = arena->size;
+      }
+    } break;
+    case Alloc_Op::REALLOC: {
+      Mem_Size old_offset = old_ptr ? (Mem_Size)((byte *)old_ptr - arena->data) : 0;
+      if (!old_ptr) {
+        result = arena_allocator(Alloc_Op::ALLOC, size, allocator_data, nullptr, align);
+      } else if (old_offset == arena->last_offset && old_offset <= arena->size &&
+                 (Mem_Size)old_ptr % align == 0) {
+        // the newest block ends at size, so it can grow or shrink in place
+        Mem_Size new_size = old_offset + align_up(size, align);
+        bool fits = arena_ensure_committed(arena, new_size);
+        assert(fits);
+        if (fits) {
+          result = old_ptr;
+          arena->size = new_size;
+          if (arena->size > arena->peak) arena->peak = arena->size;
+        }
+      } else {
+        // the old block's size isn't stored, but it ends before arena->size,
+        // copying up to there covers it and can't overlap the new block
+        Mem_Size used = arena->size - old_offset;
+        result = arena_allocator(Alloc_Op::ALLOC, size, allocator_data, nullptr, align);
+        if (result) {
+          memcpy(result, old_ptr, used < size ? used : size);
+        }
+      }
+    } break;
+    case Alloc_Op::FREE: {
+
+    } break;
+    case Alloc_Op::FREE_ALL: {
+      arena_reset(arena);
+    } break;
+  }
+  return result;
+}
+
+// Fixed size classes from 16 to 2048 bytes carved out of POOL_SLAB_SIZE
+// slabs, freed blocks go on a per-class intrusive free list. Every slab
+// holds one class, so a block's class is read from its slab header.
+// Bigger or more aligned requests go to the fallback allocator. A pool
+// is not thread safe, give each thread its own.
+#define POOL_SLAB_SIZE kilobytes(64)
+#define POOL_SLAB_HEADER_SIZE 64
+#define POOL_MIN_BLOCK_SIZE 16
+#define POOL_CLASS_COUNT 8
+
+struct Pool {
+  // one reserved range for all slabs, so a pointer is ours if it's inside
+  Arena slabs;
+  void *free_lists[POOL_CLASS_COUNT];
+  // unused tail of each class's newest slab
+  byte *carve[POOL_CLASS_COUNT];
+  byte *carve_end[POOL_CLASS_COUNT];
+
+  Allocator fallback;
+  void *fallback_data;
+};
+
+Pool make_pool(Mem_Size reserve_size = gigabytes(1), Allocator fallback = heap_allocator,
+               void *fallback_data = nullptr) {
+  Pool result = {
+    .slabs = make_arena(reserve_size),
+    .fallback = fallback,
+    .fallback_data = fallback_data,
+  };
+  return result;
+}
+
+void free_pool(Pool *pool) {
+  free_arena(&pool->slabs);
+  *pool = {};
+}
+
+// POOL_CLASS_COUNT when the block doesn't fit in a pool class
+u32 pool_size_class(Mem_Size size, Mem_Size align) {
+  Mem_Size block_size = POOL_MIN_BLOCK_SIZE;
+  u32 result = 0;
+  while (result < POOL_CLASS_COUNT && (block_size < size || block_size < align)) {
+    block_size *= 2;
+    result++;
+  }
+  if (align > POOL_SLAB_HEADER_SIZE) {
+    result = POOL_CLASS_COUNT;
+  }
+  return result;
+}
+
+Mem_Size pool_block_size(u32 size_class) {
+  Mem_Size result = (Mem_Size)POOL_MIN_BLOCK_SIZE << size_class;
+  return result;
+}
+
+bool pool_owns(Pool *pool, void *ptr) {
+  bool result = (byte *)ptr >= pool->slabs.data && (byte *)ptr < pool->slabs.data + pool->slabs.size;
+  return result;
+}
+
+u32 pool_block_class(Pool *pool, void *ptr) {
+  Mem_Size slab_offset = ((byte *)ptr - pool->slabs.data)/POOL_SLAB_SIZE*POOL_SLAB_SIZE;
+  u32 result = *(u32 *)(pool->slabs.data + slab_offset);
+  return result;
+}
+
+void *pool_alloc_block(Pool *pool, u32 size_class) {
+  void *result = pool->free_lists[size_class];
+  if (result) {
+    pool->free_lists[size_class] = *(void **)result;
+  } else {
+    Mem_Size block_size = pool_block_size(size_class);
+    if (pool->carve[size_class] + block_size > pool->carve_end[size_class]) {
+      byte *slab = (byte *)arena_allocator(Alloc_Op::ALLOC, POOL_SLAB_SIZE, &pool->slabs, nullptr,
+                                           POOL_SLAB_HEADER_SIZE);
+      *(u32 *)slab = size_class;
+      pool->carve[size_class] = slab + POOL_SLAB_HEADER_SIZE;
+      pool->carve_end[size_class] = slab + POOL_SLAB_SIZE;
+    }
+    result = pool->carve[size_class];
+    pool->carve[size_class] += block_size;
+  }
+  return result;
+}
+
+void pool_free_block(Pool *pool, void *ptr) {
+  u32 size_class = pool_block_class(pool, ptr);
+  *(void **)ptr = pool->free_lists[size_class];
+  pool->free_lists[size_class] = ptr;
+}
+
+void *pool_allocator(Alloc_Op op, Mem_Size size, void *allocator_data, void *old_ptr, Mem_Size align = 4*8) {
+  void *result = nullptr;
+  Pool *pool = (Pool *)allocator_data;
+
+  switch (op) {
+    case Alloc_Op::ALLOC: {
+      u32 size_class = pool_size_class(size, align);
+      if (size_class < POOL_CLASS_COUNT) {
+        result = pool_alloc_block(pool, size_class);
+      } else {
+        result = pool->fallback(Alloc_Op::ALLOC, size, pool->fallback_data, nullptr, align);
       }
+    } break;
+    case Alloc_Op::REALLOC: {
+      if (!old_ptr) {
+        result = pool_allocator(Alloc_Op::ALLOC, size, allocator_data, nullptr, align);
+      } else if (!pool_owns(pool, old_ptr)) {
+        // the fallback knows its block sizes, ours it doesn't
+        result = pool->fallback(Alloc_Op::REALLOC, size, pool->fallback_data, old_ptr, align);
+      } else if (pool_size_class(size, align) == pool_block_class(pool, old_ptr)) {
+        result = old_ptr;
+      } else {
+        Mem_Size old_size = pool_block_size(pool_block_class(pool, old_ptr));
+        result = pool_allocator(Alloc_Op::ALLOC, size, allocator_data, nullptr, align);
+        memcpy(result, old_ptr, old_size < size ? old_size : size);
+        pool_free_block(pool, old_ptr);
+      }
+    } break;
+    case Alloc_Op::FREE: {
+      if (pool_owns(pool, old_ptr)) {
+        pool_free_block(pool, old_ptr);
+      } else {
+        pool->fallback(Alloc_Op::FREE, 0, pool->fallback_data, old_ptr, align);
+      }
+    } break;
+    case Alloc_Op::FREE_ALL: {
+      // only pooled blocks, fallback allocations stay with their owner
+      arena_reset(&pool->slabs);
+      for (u32 i = 0; i < POOL_CLASS_COUNT; i++) {
+        pool->free_lists[i] = nullptr;
+        pool->carve[i] = nullptr;
+        pool->carve_end[i] = nullptr;
+      }
+    } break;
+  }
+  return result;
+}
+
+// Arena many threads allocate from at once, e.g. tasks appending commands
+// or tile bins to one output. A thread takes a chunk of the reserved
+// range with one atomic add on the shared cursor and then bumps inside it
+// without synchronization, so the contended counter is touched once per
+// chunk instead of once per allocation. Requests larger than a chunk get
+// a chunk of their own. Pages are committed in big steps under a spin
+// lock that is only taken when the cursor passes the committed end.
+// Every block is preceded by its size, REALLOC copies exactly that much
+// and never reads memory another thread may be writing.
+// Reset it only while no thread allocates, e.g. after wait_for_all_tasks.
+#define SHARED_ARENA_CHUNK_SIZE kilobytes(64)
+#define SHARED_ARENA_HEADER_SIZE sizeof(Mem_Size)
+#define SHARED_ARENA_COMMIT_STEP megabytes(1)
+#define SHARED_ARENA_MAX_THREADS 64
+
+// one cache line per thread, so threads bumping their chunks don't share lines
+struct alignas(64) Shared_Arena_Chunk {
+  Mem_Size at;
+  Mem_Size end;
+  // offset of the thread's newest allocation, REALLOC grows it in place
+  Mem_Size last;
+};
+
+struct Shared_Arena {
+  byte *data;
+  Mem_Size reserved;
+  Mem_Size high_water;
+
+  alignas(64) volatile Mem_Size cursor;
+  volatile Mem_Size committed;
+  volatile u32 commit_lock;
 
-      Mem_Size ptr = (Mem_Size)arena->data + arena->size;
-      if (ptr % align != 0) {
-          Mem_Size added_align = align - ptr % align;
-          ptr += added_align;
-          arena->size += added_align;
+  Shared_Arena_Chunk chunks[SHARED_ARENA_MAX_THREADS];
+};
+
+// Threads get a chunk slot the first time they allocate from any shared
+// arena and keep it for their lifetime.
+globalvar volatile Mem_Size __shared_arena_thread_count;
+globalvar thread_local u32 __shared_arena_thread_slot = U32_MAX;
+
+u32 shared_arena_thread_slot() {
+  if (__shared_arena_thread_slot == U32_MAX) {
+    __shared_arena_thread_slot = (u32)atomic_add(&__shared_arena_thread_count, 1);
+    assert(__shared_arena_thread_slot < SHARED_ARENA_MAX_THREADS);
+  }
+  return __shared_arena_thread_slot;
+}
+
+Shared_Arena make_shared_arena(Mem_Size reserve_size) {
+  Shared_Arena result = {};
+  result.reserved = align_up(reserve_size, SHARED_ARENA_COMMIT_STEP);
+  result.data = (byte *)os_reserve(result.reserved, false);
+  result.high_water = ARENA_DEFAULT_HIGH_WATER;
+  assert(result.data);
+  return result;
+}
+
+void free_shared_arena(Shared_Arena *arena) {
+  os_release(arena->data, arena->reserved);
+  *arena = {};
+}
+
+void shared_arena_commit(Shared_Arena *arena, Mem_Size end) {
+  while (arena->committed < end) {
+    if (atomic_compare_exchange(&arena->commit_lock, 1, 0) == 0) {
+      Mem_Size committed = arena->committed;
+      if (committed < end) {
+        Mem_Size new_committed = align_up(end, SHARED_ARENA_COMMIT_STEP);
+        bool ok = os_commit(arena->data + committed, new_committed - committed);
+        assert(ok);
+        arena->committed = new_committed;
       }
-      result = (void *)ptr;
-      arena->size += aligned_size;
+      atomic_compare_exchange(&arena->commit_lock, 0, 1);
+    }
+  }
+}
+
+Mem_Size shared_arena_block_size(void *ptr) {
+  Mem_Size result;
+  memcpy(&result, (byte *)ptr - SHARED_ARENA_HEADER_SIZE, SHARED_ARENA_HEADER_SIZE);
+  return result;
+}
+
+void shared_arena_set_block_size(void *ptr, Mem_Size size) {
+  memcpy((byte *)ptr - SHARED_ARENA_HEADER_SIZE, &size, SHARED_ARENA_HEADER_SIZE);
+}
+
+void *shared_arena_alloc(Shared_Arena *arena, Mem_Size size, Mem_Size align = 4*8) {
+  Shared_Arena_Chunk *chunk = arena->chunks + shared_arena_thread_slot();
+  Mem_Size start = align_up(chunk->at + SHARED_ARENA_HEADER_SIZE, align);
+  if (start + size > chunk->end) {
+    Mem_Size chunk_size = align_up(size + align + SHARED_ARENA_HEADER_SIZE, SHARED_ARENA_CHUNK_SIZE);
+    Mem_Size chunk_start = atomic_add(&arena->cursor, chunk_size);
+    bool fits = chunk_start + chunk_size <= arena->reserved;
+    assert(fits);
+    shared_arena_commit(arena, chunk_start + chunk_size);
+    chunk->at = chunk_start;
+    chunk->end = chunk_start + chunk_size;
+    start = align_up(chunk->at + SHARED_ARENA_HEADER_SIZE, align);
+  }
+  chunk->last = start;
+  chunk->at = start + size;
+  void *result = arena->data + start;
+  shared_arena_set_block_size(result, size);
+  return result;
+}
+
+// Frees everything, not thread safe. Committed pages past high_water go
+// back to the os like in arena_reset.
+void shared_arena_reset(Shared_Arena *arena) {
+  arena->cursor = 0;
+  memset(arena->chunks, 0, sizeof(arena->chunks));
+  if (arena->committed > arena->high_water) {
+    Mem_Size keep = align_up(arena->high_water, SHARED_ARENA_COMMIT_STEP);
+    if (keep < arena->committed) {
+      os_decommit(arena->data + keep, arena->committed - keep);
+      arena->committed = keep;
+    }
+  }
+}
+
+void *shared_arena_allocator(Alloc_Op op, Mem_Size size, void *allocator_data, void *old_ptr, Mem_Size align = 4*8) {
+  void *result = nullptr;
+  Shared_Arena *arena = (Shared_Arena *)allocator_data;
+
+  switch (op) {
+    case Alloc_Op::ALLOC: {
+      result = shared_arena_alloc(arena, size, align);
     } break;
     case Alloc_Op::REALLOC: {
-      // TODO: to realloc on an arena, we need the old block size
-      // Mem_Size aligned_size = size;
-      // if (aligned_size % align != 0) {
-      //     aligned_size += align - aligned_size % align;
-      // }
-
-      // Mem_Size ptr = (Mem_Size)arena->data + arena->size;
-      // if (ptr % align != 0) {
-      //     Mem_Size added_align = align - ptr % align;
-      //     ptr += added_align;
-      //     arena->size += added_align;
-      // }
-      // result = (void *)ptr;
-      // arena->size += aligned_size;
+      Shared_Arena_Chunk *chunk = arena->chunks + shared_arena_thread_slot();
+      Mem_Size old_offset = old_ptr ? (Mem_Size)((byte *)old_ptr - arena->data) : 0;
+      if (old_ptr && old_offset == chunk->last && old_offset + size <= chunk->end) {
+        // this thread's newest allocation, grow or shrink it in place
+        result = old_ptr;
+        chunk->at = old_offset + size;
+        shared_arena_set_block_size(result, size);
+      } else {
+        result = shared_arena_alloc(arena, size, align);
+        if (old_ptr) {
+          Mem_Size old_size = shared_arena_block_size(old_ptr);
+          memcpy(result, old_ptr, old_size < size ? old_size : size);
+        }
+      }
     } break;
     case Alloc_Op::FREE: {
 
     } break;
     case Alloc_Op::FREE_ALL: {
-      arena->size = 0;
+      shared_arena_reset(arena);
+    } break;
+  }
+
+  return result;
+}
+
+// Call site of the next allocation, set by the LVL5_TRACK_ALLOCATIONS
+// macros and read by tracking_allocator.
+globalvar thread_local const char *__alloc_site_file;
+globalvar thread_local u32 __alloc_site_line;
+
+void __set_alloc_site(const char *file, u32 line) {
+  __alloc_site_file = file;
+  __alloc_site_line = line;
+}
+
+// Lives until the end of the full expression it's created in, so a tagged
+// call that doesn't allocate, e.g. an array_push without growth, puts the
+// previous site back instead of lending its own to the next allocation.
+struct Alloc_Site_Scope {
+  const char *file;
+  u32 line;
+
+  Alloc_Site_Scope(const char *new_file, u32 new_line) : file(__alloc_site_file), line(__alloc_site_line) {
+    __set_alloc_site(new_file, new_line);
+  }
+  ~Alloc_Site_Scope() { __set_alloc_site(file, line); }
+};
+
+struct Alloc_Site {
+  const char *file;
+  u32 line;
+  u32 count;
+  u32 live_count;
+  Mem_Size bytes;
+  Mem_Size live_bytes;
+  Mem_Size peak_live_bytes;
+};
+
+struct Alloc_Record {
+  void *ptr;
+  Mem_Size size;
+  u32 site;
+};
+
+// Wraps another allocator and keeps per call site totals plus a table of
+// live blocks, which is the leak report. Not thread safe, like the
+// context stack it is pushed on. Site 0 collects allocations made
+// without a site, e.g. from code compiled before the macros.
+#define ALLOC_TRACKER_SITE_CAPACITY 1024
+
+struct Alloc_Tracker {
+  Allocator parent;
+  void *parent_data;
+
+  Alloc_Site *sites;
+  u32 site_count;
+
+  // open addressing on the pointer, linear probing, capacity is a power of 2
+  Alloc_Record *records;
+  u32 record_count;
+  u32 record_capacity;
+
+  Mem_Size live_bytes;
+  Mem_Size peak_live_bytes;
+
+  u32 frame_count;
+  Mem_Size frame_scratch_peak;
+  Mem_Size max_scratch_peak;
+};
+
+void os_debug_print(const char *text) {
+#if defined(_WIN32)
+  OutputDebugStringA(text);
+#else
+  fputs(text, stderr);
+#endif
+}
+
+u32 alloc_tracker_hash(void *ptr) {
+  u64 key = (u64)ptr;
+  key ^= key >> 33;
+  key *= 0xFF51AFD7ED558CCDull;
+  key ^= key >> 33;
+  u32 result = (u32)key;
+  return result;
+}
+
+Alloc_Tracker make_alloc_tracker(Allocator parent = heap_allocator, void *parent_data = nullptr) {
+  Alloc_Tracker result = {
+    .parent = parent,
+    .parent_data = parent_data,
+    .site_count = 1,
+    .record_capacity = 1024,
+  };
+  Mem_Size sites_size = sizeof(Alloc_Site)*ALLOC_TRACKER_SITE_CAPACITY;
+  result.sites = (Alloc_Site *)parent(Alloc_Op::ALLOC, sites_size, parent_data, nullptr, 4*8);
+  memset(result.sites, 0, sites_size);
+  result.sites[0].file = "unknown";
+  Mem_Size records_size = sizeof(Alloc_Record)*result.record_capacity;
+  result.records = (Alloc_Record *)parent(Alloc_Op::ALLOC, records_size, parent_data, nullptr, 4*8);
+  memset(result.records, 0, records_size);
+  return result;
+}
+
+void free_alloc_tracker(Alloc_Tracker *tracker) {
+  tracker->parent(Alloc_Op::FREE, 0, tracker->parent_data, tracker->sites, 0);
+  tracker->parent(Alloc_Op::FREE, 0, tracker->parent_data, tracker->records, 0);
+  *tracker = {};
+}
+
+u32 alloc_tracker_site(Alloc_Tracker *tracker, const char *file, u32 line) {
+  u32 result = 0;
+  if (file) {
+    // sites are few, a linear search over the ones seen is fine
+    for (u32 i = 1; i < tracker->site_count; i++) {
+      if (tracker->sites[i].line == line && tracker->sites[i].file == file) {
+        result = i;
+        break;
+      }
+    }
+    if (!result && tracker->site_count < ALLOC_TRACKER_SITE_CAPACITY) {
+      result = tracker->site_count++;
+      tracker->sites[result].file = file;
+      tracker->sites[result].line = line;
+    }
+  }
+  return result;
+}
+
+void alloc_tracker_insert(Alloc_Tracker *tracker, Alloc_Record record) {
+  if ((tracker->record_count + 1)*4 > tracker->record_capacity*3) {
+    Alloc_Record *old_records = tracker->records;
+    u32 old_capacity = tracker->record_capacity;
+    tracker->record_capacity *= 2;
+    Mem_Size records_size = sizeof(Alloc_Record)*tracker->record_capacity;
+    tracker->records = (Alloc_Record *)tracker->parent(Alloc_Op::ALLOC, records_size, tracker->parent_data,
+                                                       nullptr, 4*8);
+    memset(tracker->records, 0, records_size);
+    tracker->record_count = 0;
+    for (u32 i = 0; i < old_capacity; i++) {
+      if (old_records[i].ptr) alloc_tracker_insert(tracker, old_records[i]);
+    }
+    tracker->parent(Alloc_Op::FREE, 0, tracker->parent_data, old_records, 0);
+  }
+
+  u32 mask = tracker->record_capacity - 1;
+  u32 slot = alloc_tracker_hash(record.ptr) & mask;
+  while (tracker->records[slot].ptr) slot = (slot + 1) & mask;
+  tracker->records[slot] = record;
+  tracker->record_count++;
+}
+
+// Removes ptr's record, false if ptr wasn't allocated through the tracker.
+bool alloc_tracker_remove(Alloc_Tracker *tracker, void *ptr, Alloc_Record *removed) {
+  u32 mask = tracker->record_capacity - 1;
+  u32 slot = alloc_tracker_hash(ptr) & mask;
+  while (tracker->records[slot].ptr && tracker->records[slot].ptr != ptr) slot = (slot + 1) & mask;
+  bool result = tracker->records[slot].ptr != nullptr;
+  if (result) {
+    *removed = tracker->records[slot];
+    // backward shift deletion, keeps probe chains intact without tombstones
+    u32 hole = slot;
+    for (u32 next = (hole + 1) & mask; tracker->records[next].ptr; next = (next + 1) & mask) {
+      u32 home = alloc_tracker_hash(tracker->records[next].ptr) & mask;
+      if (((next - home) & mask) >= ((next - hole) & mask)) {
+        tracker->records[hole] = tracker->records[next];
+        hole = next;
+      }
+    }
+    tracker->records[hole] = {};
+    tracker->record_count--;
+  }
+  return result;
+}
+
+void alloc_tracker_add(Alloc_Tracker *tracker, void *ptr, Mem_Size size, u32 site_index) {
+  Alloc_Site *site = tracker->sites + site_index;
+  site->count++;
+  site->live_count++;
+  site->bytes += size;
+  site->live_bytes += size;
+  if (site->live_bytes > site->peak_live_bytes) site->peak_live_bytes = site->live_bytes;
+  tracker->live_bytes += size;
+  if (tracker->live_bytes > tracker->peak_live_bytes) tracker->peak_live_bytes = tracker->live_bytes;
+  alloc_tracker_insert(tracker, {ptr, size, site_index});
+}
+
+// returns the site ptr was allocated at
+u32 alloc_tracker_forget(Alloc_Tracker *tracker, void *ptr) {
+  Alloc_Record record = {};
+  if (alloc_tracker_remove(tracker, ptr, &record)) {
+    Alloc_Site *site = tracker->sites + record.site;
+    site->live_count--;
+    site->live_bytes -= record.size;
+    tracker->live_bytes -= record.size;
+  }
+  return record.site;
+}
+
+void *tracking_allocator(Alloc_Op op, Mem_Size size, void *allocator_data, void *old_ptr, Mem_Size align = 4*8) {
+  Alloc_Tracker *tracker = (Alloc_Tracker *)allocator_data;
+  void *result = tracker->parent(op, size, tracker->parent_data, old_ptr, align);
+  u32 site = alloc_tracker_site(tracker, __alloc_site_file, __alloc_site_line);
+
+  switch (op) {
+    case Alloc_Op::ALLOC: {
+      if (result) alloc_tracker_add(tracker, result, size, site);
+    } break;
+    case Alloc_Op::REALLOC: {
+      // untagged growth, like an Array growing, stays with the original call site
+      u32 old_site = old_ptr ? alloc_tracker_forget(tracker, old_ptr) : 0;
+      if (result) alloc_tracker_add(tracker, result, size, site ? site : old_site);
+    } break;
+    case Alloc_Op::FREE: {
+      alloc_tracker_forget(tracker, old_ptr);
+    } break;
+    case Alloc_Op::FREE_ALL: {
+      memset(tracker->records, 0, sizeof(Alloc_Record)*tracker->record_capacity);
+      tracker->record_count = 0;
+      tracker->live_bytes = 0;
+      for (u32 i = 0; i < tracker->site_count; i++) {
+        tracker->sites[i].live_count = 0;
+        tracker->sites[i].live_bytes = 0;
+      }
     } break;
   }
   return result;
 }
 
+// Call once per frame before the scratch is reset, records how far the
+// scratch got since the last call.
+void alloc_tracker_end_frame(Alloc_Tracker *tracker, Arena *scratch) {
+  tracker->frame_count++;
+  tracker->frame_scratch_peak = scratch->peak;
+  if (scratch->peak > tracker->max_scratch_peak) tracker->max_scratch_peak = scratch->peak;
+  scratch->peak = scratch->size;
+}
+
+// Prints totals, every call site and every block still alive.
+void alloc_tracker_report(Alloc_Tracker *tracker) {
+  char buffer[512];
+  snprintf(buffer, array_count(buffer),
+           "memory: %llu bytes live, %llu peak, scratch peak %llu over %u frames\n",
+           (unsigned long long)tracker->live_bytes, (unsigned long long)tracker->peak_live_bytes,
+           (unsigned long long)tracker->max_scratch_peak, (unsigned)tracker->frame_count);
+  os_debug_print(buffer);
+
+  for (u32 i = 0; i < tracker->site_count; i++) {
+    Alloc_Site *site = tracker->sites + i;
+    if (!site->count) continue;
+    snprintf(buffer, array_count(buffer), "%s(%u): %u allocations, %llu bytes, %llu peak%s\n",
+             site->file, (unsigned)site->line, (unsigned)site->count, (unsigned long long)site->bytes,
+             (unsigned long long)site->peak_live_bytes, site->live_count ? ", LEAKS:" : "");
+    os_debug_print(buffer);
+    if (site->live_count) {
+      snprintf(buffer, array_count(buffer), "    %u blocks, %llu bytes\n",
+               (unsigned)site->live_count, (unsigned long long)site->live_bytes);
+      os_debug_print(buffer);
+    }
+  }
+}
+
 void *scratch_allocator(Alloc_Op op, Mem_Size size, void *allocator_data, void *old_ptr, Mem_Size align = 4*8) {
   Context *ctx = get_context();
   void *result = arena_allocator(op, size, ctx->scratch, old_ptr, align);
@@ -141,7 +889,7 @@ void *memalloc(Mem_Size size, Mem_Size align = 4*8) {
 
 void *memrealloc(void *old_ptr, Mem_Size size, Mem_Size align = 4*8) {
   Context *ctx = get_context();
-  void *result = ctx->allocator(Alloc_Op::REALLOC, size, ctx->allocator_data, nullptr, align);
+  void *result = ctx->allocator(Alloc_Op::REALLOC, size, ctx->allocator_data, old_ptr, align);
   return result;
 }
 
@@ -166,7 +914,7 @@ void scratch_set_mark(Mem_Size mark) {
 }
 
 void scratch_reset() {
-  get_context()->scratch->size = 0;
+  arena_reset(get_context()->scratch);
 }
 
 Context *__push_blank_context() {
@@ -193,6 +941,34 @@ Context_Scope push_context(Arena *arena) {
   return {};
 }
 
+Context_Scope push_context(Pool *pool) {
+  Context *ctx = __push_blank_context();
+  ctx->allocator = pool_allocator;
+  ctx->allocator_data = pool;
+  return {};
+}
+
+Context_Scope push_context(Shared_Arena *arena) {
+  Context *ctx = __push_blank_context();
+  ctx->allocator = shared_arena_allocator;
+  ctx->allocator_data = arena;
+  return {};
+}
+
+// Swaps only the scratch arena, allocations keep going where they went.
+Context_Scope push_scratch(Arena *scratch) {
+  Context *ctx = __push_blank_context();
+  ctx->scratch = scratch;
+  return {};
+}
+
+Context_Scope push_context(Alloc_Tracker *tracker) {
+  Context *ctx = __push_blank_context();
+  ctx->allocator = tracking_allocator;
+  ctx->allocator_data = tracker;
+  return {};
+}
+
 Context_Scope push_scratch_context() {
   Context *ctx = __push_blank_context();
   ctx->allocator = scratch_allocator;
@@ -200,58 +976,590 @@ Context_Scope push_scratch_context() {
 }
 
 
-struct sb_Header {
-  void *data;
+// Frame lifetimes for the main loop. THIS_FRAME is the scratch arena,
+// gone at the next begin_frame. NEXT_FRAME goes to one of two arenas that
+// take turns, what is allocated in frame n is still there in frame n + 1
+// and is freed when frame n + 2 begins. That covers data compared against
+// or finished by the following frame, e.g. last frame's commands or
+// upload staging, without going to the heap.
+// NOTE: main thread only, tasks have their own scratch
+enum class Frame_Lifetime {
+  THIS_FRAME,
+  NEXT_FRAME,
+};
+
+struct Frame_Arenas {
+  Arena arenas[2];
+  u32 frame_index;
+};
+
+#define __DEFAULT_FRAME_RESERVE gigabytes(1)
+globalvar Frame_Arenas __global_frame_arenas;
+
+Arena *get_frame_arena(Frame_Lifetime lifetime) {
+  Arena *result = get_context()->scratch;
+  if (lifetime == Frame_Lifetime::NEXT_FRAME) {
+    Frame_Arenas *frames = &__global_frame_arenas;
+    if (!frames->arenas[0].data) {
+      frames->arenas[0] = make_arena(__DEFAULT_FRAME_RESERVE);
+      frames->arenas[1] = make_arena(__DEFAULT_FRAME_RESERVE);
+    }
+    result = frames->arenas + (frames->frame_index & 1);
+  }
+  return result;
+}
+
+void *frame_alloc(Mem_Size size, Frame_Lifetime lifetime = Frame_Lifetime::THIS_FRAME, Mem_Size align = 4*8) {
+  void *result = arena_allocator(Alloc_Op::ALLOC, size, get_frame_arena(lifetime), nullptr, align);
+  return result;
+}
+
+// Arrays and memalloc inside the scope get the lifetime,
+// memfree does nothing there
+Context_Scope push_context(Frame_Lifetime lifetime) {
+  return push_context(get_frame_arena(lifetime));
+}
+
+// Ends the previous frame: scratch is reset and the NEXT_FRAME arena
+// written two frames ago becomes the current one.
+void begin_frame() {
+  scratch_reset();
+  Frame_Arenas *frames = &__global_frame_arenas;
+  frames->frame_index++;
+  if (frames->arenas[0].data) {
+    arena_reset(frames->arenas + (frames->frame_index & 1));
+  }
+}
+
+
+// Typed growable array. It keeps the allocator it was made with (or the
+// context's when it first grows) and grows through REALLOC, so the newest
+// array on an arena is extended in place.
+template<typename T>
+struct Slice {
+  T *data;
+  u32 count;
+
+  T &operator[](u32 index) {
+    assert(index < count);
+    return data[index];
+  }
+  T *begin() { return data; }
+  T *end() { return data + count; }
+};
+
+template<typename T>
+struct Array {
+  T *data;
   u32 count;
   u32 capacity;
 
   Allocator allocator;
   void *allocator_data;
+
+  T &operator[](u32 index) {
+    assert(index < count);
+    return data[index];
+  }
+  T *begin() { return data; }
+  T *end() { return data + count; }
+  operator Slice<T>() { return {data, count}; }
 };
 
-#define sb_make(T, capacity) (T *)(__sb_make(sizeof(T), capacity))
-#define sb_count(arr) (((sb_Header *)(arr) - 1)->count)
-#define sb_push(arr, element) (__sb_maybe_grow((void **)&(arr), sizeof(element)), (arr)[sb_count(arr) - 1] = element)
+template<typename T>
+void array_reserve(Array<T> *array, u32 capacity) {
+  if (capacity > array->capacity) {
+    if (!array->allocator) {
+      Context *ctx = get_context();
+      array->allocator = ctx->allocator;
+      array->allocator_data = ctx->allocator_data;
+    }
+    array->data = (T *)array->allocator(Alloc_Op::REALLOC, sizeof(T)*capacity, array->allocator_data,
+                                        array->data, alignof(T) > 4*8 ? alignof(T) : 4*8);
+    array->capacity = capacity;
+  }
+}
 
-void *__sb_make(Mem_Size element_size, u32 capacity) {
+template<typename T>
+Array<T> make_array(u32 capacity = 0) {
   Context *ctx = get_context();
+  Array<T> result = {};
+  result.allocator = ctx->allocator;
+  result.allocator_data = ctx->allocator_data;
+  array_reserve(&result, capacity);
+  return result;
+}
+
+template<typename T>
+void array_free(Array<T> *array) {
+  if (array->data) {
+    array->allocator(Alloc_Op::FREE, 0, array->allocator_data, array->data, 0);
+  }
+  *array = {};
+}
 
-  sb_Header *array_memory = (sb_Header *)memalloc(sizeof(sb_Header) + element_size*capacity);
-  memset(array_memory, 0, sizeof(sb_Header) + element_size*capacity);
+// geometric growth, amortized O(1) pushes
+template<typename T>
+void array_grow_for(Array<T> *array, u32 count) {
+  if (array->count + count > array->capacity) {
+    u32 capacity = array->capacity ? array->capacity*2 : 8;
+    if (capacity < array->count + count) capacity = array->count + count;
+    array_reserve(array, capacity);
+  }
+}
 
-  sb_Header header = {
-    .data = array_memory + 1,
-    .capacity = capacity,
-    .count = 0,
-    .allocator = ctx->allocator,
-    .allocator_data = ctx->allocator_data,
-  };
-  *array_memory = header;
+template<typename T>
+T *array_push(Array<T> *array, T element) {
+  array_grow_for(array, 1);
+  T *result = array->data + array->count++;
+  *result = element;
+  return result;
+}
+
+template<typename T>
+T *array_append(Array<T> *array, Slice<T> elements) {
+  array_grow_for(array, elements.count);
+  T *result = array->data + array->count;
+  memcpy(result, elements.data, sizeof(T)*elements.count);
+  array->count += elements.count;
+  return result;
+}
+
+template<typename T>
+T array_pop(Array<T> *array) {
+  assert(array->count);
+  T result = array->data[--array->count];
+  return result;
+}
+
+template<typename T>
+void array_insert(Array<T> *array, u32 index, T element) {
+  assert(index <= array->count);
+  array_grow_for(array, 1);
+  memmove(array->data + index + 1, array->data + index, sizeof(T)*(array->count - index));
+  array->data[index] = element;
+  array->count++;
+}
+
+// keeps the order, O(count)
+template<typename T>
+void array_remove(Array<T> *array, u32 index) {
+  assert(index < array->count);
+  memmove(array->data + index, array->data + index + 1, sizeof(T)*(array->count - index - 1));
+  array->count--;
+}
+
+// moves the last element into the hole, O(1)
+template<typename T>
+void array_remove_unordered(Array<T> *array, u32 index) {
+  assert(index < array->count);
+  array->data[index] = array->data[--array->count];
+}
+
+template<typename T>
+void array_clear(Array<T> *array) {
+  array->count = 0;
+}
 
-  return header.data;
+template<typename T>
+Slice<T> array_slice(Array<T> array, u32 start, u32 count) {
+  assert(start + count <= array.count);
+  Slice<T> result = {array.data + start, count};
+  return result;
 }
 
-void __sb_maybe_grow(void **arr_ptr, Mem_Size element_size) {
-  void *arr = *arr_ptr;
-  assert(arr);
-  sb_Header *header = (sb_Header *)arr - 1;
-  assert(header->allocator);
-  assert(header->capacity);
 
-  if (header->count == header->capacity) {
-    header->capacity *= 2;
-    sb_Header *array_memory = (sb_Header *)memalloc(sizeof(sb_Header) + element_size*header->capacity);
-    memset(array_memory, 0, sizeof(sb_Header) + element_size*header->capacity);
-    memcpy(array_memory + 1, header->data, header->count*element_size);
-    header->data = array_memory + 1;
-    *array_memory = *header;
-    memfree(header);
-    header = array_memory;
+// Open addressing hash map with Robin Hood probing: an entry that is
+// further from its home slot takes the slot of one that is closer, so
+// probe lengths stay short and a miss stops as soon as it meets an entry
+// closer to home than the key would be. Hashes, keys and values live in
+// separate arrays of one block, a probe only walks the hashes and compares
+// a key when the full 32 bit hash matches. Like Array it keeps the
+// allocator it was made with. Capacity is a power of 2, hash 0 marks an
+// empty slot.
+//
+// Integers, enums and pointers hash by value, const char * keys by
+// content and are compared with strcmp. The map stores the pointer, the
+// string has to outlive its entry.
+template<typename K>
+u32 hash_key(K key) {
+  u64 x = (u64)key;
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDull;
+  x ^= x >> 33;
+  u32 result = (u32)x;
+  return result;
+}
+
+u32 hash_key(const char *key) {
+  // FNV-1a plus the integer finalizer, names are short
+  u64 x = 0xCBF29CE484222325ull;
+  for (const char *at = key; *at; at++) {
+    x ^= (u8)*at;
+    x *= 0x100000001B3ull;
   }
+  u32 result = hash_key<u64>(x);
+  return result;
+}
+
+template<typename K>
+bool hash_key_equals(K a, K b) {
+  return a == b;
+}
 
-  header->count++;
-  *arr_ptr = header->data;
+bool hash_key_equals(const char *a, const char *b) {
+  return a == b || strcmp(a, b) == 0;
 }
 
+template<typename K, typename V>
+struct Hash_Map {
+  u32 *hashes;
+  K *keys;
+  V *values;
+  u32 count;
+  u32 capacity;
+
+  Allocator allocator;
+  void *allocator_data;
+};
+
+#define HASH_MAP_MIN_CAPACITY 16
+
+template<typename K>
+u32 hash_map_hash(K key) {
+  u32 result = hash_key(key);
+  if (!result) result = 1;
+  return result;
+}
+
+template<typename K, typename V>
+void hash_map_alloc_slots(Hash_Map<K, V> *map, u32 capacity) {
+  Mem_Size keys_offset = align_up(sizeof(u32)*capacity, alignof(K));
+  Mem_Size values_offset = align_up(keys_offset + sizeof(K)*capacity, alignof(V));
+  Mem_Size size = values_offset + sizeof(V)*capacity;
+  u8 *block = (u8 *)map->allocator(Alloc_Op::ALLOC, size, map->allocator_data, nullptr, 4*8);
+  memset(block, 0, sizeof(u32)*capacity);
+  map->hashes = (u32 *)block;
+  map->keys = (K *)(block + keys_offset);
+  map->values = (V *)(block + values_offset);
+  map->capacity = capacity;
+  map->count = 0;
+}
+
+// Places an entry known not to be in the map, returns the slot it ended
+// up in. Entries displaced on the way keep moving until one finds a hole.
+template<typename K, typename V>
+u32 hash_map_place(Hash_Map<K, V> *map, u32 hash, K key, V value) {
+  u32 mask = map->capacity - 1;
+  u32 slot = hash & mask;
+  u32 distance = 0;
+  u32 result = U32_MAX;
+  while (map->hashes[slot]) {
+    u32 other_distance = (slot - map->hashes[slot]) & mask;
+    if (other_distance < distance) {
+      u32 other_hash = map->hashes[slot];
+      K other_key = map->keys[slot];
+      V other_value = map->values[slot];
+      map->hashes[slot] = hash;
+      map->keys[slot] = key;
+      map->values[slot] = value;
+      if (result == U32_MAX) result = slot;
+      hash = other_hash;
+      key = other_key;
+      value = other_value;
+      distance = other_distance;
+    }
+    slot = (slot + 1) & mask;
+    distance++;
+  }
+  map->hashes[slot] = hash;
+  map->keys[slot] = key;
+  map->values[slot] = value;
+  if (result == U32_MAX) result = slot;
+  map->count++;
+  return result;
+}
+
+// room for count entries without growing, keeps the load under 7/8
+template<typename K, typename V>
+void hash_map_reserve(Hash_Map<K, V> *map, u32 count) {
+  // in u64, count*8 wraps from 2^29 on. 2^31 slots is the most a u32
+  // capacity can double to
+  assert((u64)count*8 <= (u64)0x80000000*7);
+  u64 capacity = map->capacity ? map->capacity : HASH_MAP_MIN_CAPACITY;
+  while ((u64)count*8 > capacity*7) capacity *= 2;
+  if (capacity > map->capacity) {
+    if (!map->allocator) {
+      Context *ctx = get_context();
+      map->allocator = ctx->allocator;
+      map->allocator_data = ctx->allocator_data;
+    }
+    Hash_Map<K, V> old = *map;
+    hash_map_alloc_slots(map, (u32)capacity);
+    for (u32 i = 0; i < old.capacity; i++) {
+      if (old.hashes[i]) hash_map_place(map, old.hashes[i], old.keys[i], old.values[i]);
+    }
+    if (old.hashes) map->allocator(Alloc_Op::FREE, 0, map->allocator_data, old.hashes, 0);
+  }
+}
+
+template<typename K, typename V>
+Hash_Map<K, V> make_hash_map(u32 count = 0) {
+  Context *ctx = get_context();
+  Hash_Map<K, V> result = {};
+  result.allocator = ctx->allocator;
+  result.allocator_data = ctx->allocator_data;
+  if (count) hash_map_reserve(&result, count);
+  return result;
+}
+
+template<typename K, typename V>
+void hash_map_free(Hash_Map<K, V> *map) {
+  if (map->hashes) {
+    map->allocator(Alloc_Op::FREE, 0, map->allocator_data, map->hashes, 0);
+  }
+  *map = {};
+}
+
+// slot holding key, U32_MAX if it isn't in the map
+template<typename K, typename V>
+u32 hash_map_find(Hash_Map<K, V> *map, K key) {
+  u32 result = U32_MAX;
+  if (map->count) {
+    u32 hash = hash_map_hash(key);
+    u32 mask = map->capacity - 1;
+    u32 slot = hash & mask;
+    for (u32 distance = 0; map->hashes[slot]; distance++) {
+      if (((slot - map->hashes[slot]) & mask) < distance) break;
+      if (map->hashes[slot] == hash && hash_key_equals(map->keys[slot], key)) {
+        result = slot;
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+  }
+  return result;
+}
+
+// nullptr when key isn't in the map
+template<typename K, typename V>
+V *hash_map_get(Hash_Map<K, V> *map, K key) {
+  u32 slot = hash_map_find(map, key);
+  V *result = slot != U32_MAX ? map->values + slot : nullptr;
+  return result;
+}
+
+// inserts or overwrites, the pointer is valid until the map changes
+template<typename K, typename V>
+V *hash_map_put(Hash_Map<K, V> *map, K key, V value) {
+  u32 slot = hash_map_find(map, key);
+  if (slot == U32_MAX) {
+    hash_map_reserve(map, map->count + 1);
+    slot = hash_map_place(map, hash_map_hash(key), key, value);
+  } else {
+    map->values[slot] = value;
+  }
+  V *result = map->values + slot;
+  return result;
+}
+
+template<typename K, typename V>
+bool hash_map_remove(Hash_Map<K, V> *map, K key) {
+  u32 slot = hash_map_find(map, key);
+  bool result = slot != U32_MAX;
+  if (result) {
+    // backward shift deletion, pulls the rest of the chain one slot closer to home
+    u32 mask = map->capacity - 1;
+    u32 next = (slot + 1) & mask;
+    while (map->hashes[next] && ((next - map->hashes[next]) & mask) != 0) {
+      map->hashes[slot] = map->hashes[next];
+      map->keys[slot] = map->keys[next];
+      map->values[slot] = map->values[next];
+      slot = next;
+      next = (next + 1) & mask;
+    }
+    map->hashes[slot] = 0;
+    map->count--;
+  }
+  return result;
+}
+
+template<typename K, typename V>
+void hash_map_clear(Hash_Map<K, V> *map) {
+  if (map->hashes) memset(map->hashes, 0, sizeof(u32)*map->capacity);
+  map->count = 0;
+}
+
+// iterates the occupied slots, in no particular order
+#define hash_map_for(map, slot) \
+  for (u32 slot = 0; slot < (map)->capacity; slot++) if ((map)->hashes[slot])
+
+
+// Slot map: items are stored densely and addressed through handles that
+// stay valid while the item lives, however the dense array moves. A
+// handle names a slot plus the slot's generation, removing an item bumps
+// the generation and puts the slot on a free list, so an old handle
+// stops resolving even after the slot is reused. Lookup, add and remove
+// are O(1), removal moves the last item into the hole.
+// Until the first removal item i is in slot i at generation 1, so the
+// slot arrays are only built then and adding is a single push.
+struct Handle {
+  u32 index;
+  u32 generation;
+};
+
+struct Slot_Map_Slot {
+  // dense index of the item, next free slot while the slot is free
+  u32 item;
+  // starts at 1, so a zeroed Handle never resolves
+  u32 generation;
+};
+
+template<typename T>
+struct Slot_Map {
+  Array<T> items;
+  // slot of each item, to fix it up when the item moves
+  Array<u32> item_slots;
+  Array<Slot_Map_Slot> slots;
+  u32 free_head;
+  u32 free_count;
+  // set by the first removal, slots and item_slots are valid from then on
+  bool sparse;
+
+  // bumped by every add and remove, for anything built over items
+  u32 version;
+};
+
+template<typename T>
+Slot_Map<T> make_slot_map(u32 capacity = 0) {
+  Slot_Map<T> result = {};
+  result.items = make_array<T>(capacity);
+  result.item_slots = make_array<u32>();
+  result.slots = make_array<Slot_Map_Slot>();
+  return result;
+}
+
+// builds the identity slots the map stood for while it was dense
+template<typename T>
+void slot_map_make_sparse(Slot_Map<T> *map) {
+  if (!map->sparse) {
+    map->sparse = true;
+    array_reserve(&map->slots, map->items.capacity);
+    array_reserve(&map->item_slots, map->items.capacity);
+    for (u32 i = 0; i < map->items.count; i++) {
+      array_push(&map->slots, {i, 1});
+      array_push(&map->item_slots, i);
+    }
+  }
+}
+
+template<typename T>
+void slot_map_free(Slot_Map<T> *map) {
+  array_free(&map->items);
+  array_free(&map->item_slots);
+  array_free(&map->slots);
+  *map = {};
+}
+
+template<typename T>
+void slot_map_reserve(Slot_Map<T> *map, u32 count) {
+  array_reserve(&map->items, count);
+  if (map->sparse) {
+    array_reserve(&map->item_slots, count);
+    array_reserve(&map->slots, count);
+  }
+}
+
+template<typename T>
+Handle slot_map_add(Slot_Map<T> *map, T item) {
+  if (!map->sparse) {
+    array_push(&map->items, item);
+    map->version++;
+    Handle result = {map->items.count - 1, 1};
+    return result;
+  }
+
+  u32 slot_index;
+  if (map->free_count) {
+    slot_index = map->free_head;
+    map->free_head = map->slots[slot_index].item;
+    map->free_count--;
+  } else {
+    slot_index = map->slots.count;
+    array_push(&map->slots, {0, 1});
+  }
+  Slot_Map_Slot *slot = &map->slots[slot_index];
+  slot->item = map->items.count;
+  array_push(&map->items, item);
+  array_push(&map->item_slots, slot_index);
+  map->version++;
+  Handle result = {slot_index, slot->generation};
+  return result;
+}
+
+// nullptr once the item is removed
+template<typename T>
+T *slot_map_get(Slot_Map<T> *map, Handle handle) {
+  T *result = nullptr;
+  if (!map->sparse) {
+    if (handle.index < map->items.count && handle.generation == 1) result = map->items.data + handle.index;
+  } else if (handle.index < map->slots.count && map->slots[handle.index].generation == handle.generation) {
+    result = map->items.data + map->slots[handle.index].item;
+  }
+  return result;
+}
+
+template<typename T>
+Handle slot_map_handle_at(Slot_Map<T> *map, u32 item_index) {
+  Handle result = {item_index, 1};
+  if (map->sparse) {
+    u32 slot_index = map->item_slots[item_index];
+    result = {slot_index, map->slots[slot_index].generation};
+  }
+  return result;
+}
+
+// removes by dense index, handy while walking items from the back
+template<typename T>
+void slot_map_remove_at(Slot_Map<T> *map, u32 item_index) {
+  slot_map_make_sparse(map);
+  u32 slot_index = map->item_slots[item_index];
+  u32 last = map->items.count - 1;
+  if (item_index != last) {
+    map->slots[map->item_slots[last]].item = item_index;
+  }
+  array_remove_unordered(&map->items, item_index);
+  array_remove_unordered(&map->item_slots, item_index);
+
+  Slot_Map_Slot *slot = &map->slots[slot_index];
+  slot->generation++;
+  slot->item = map->free_head;
+  map->free_head = slot_index;
+  map->free_count++;
+  map->version++;
+}
+
+template<typename T>
+bool slot_map_remove(Slot_Map<T> *map, Handle handle) {
+  T *item = slot_map_get(map, handle);
+  if (item) slot_map_remove_at(map, (u32)(item - map->items.data));
+  return item != nullptr;
+}
+
+// NOTE: tags allocations with their call site for tracking_allocator,
+// everything below this point in the translation unit is covered. The
+// site holds for the whole expression and is dropped after it
+#ifdef LVL5_TRACK_ALLOCATIONS
+#define memalloc(...) (Alloc_Site_Scope(__FILE__, __LINE__), memalloc(__VA_ARGS__))
+#define memrealloc(...) (Alloc_Site_Scope(__FILE__, __LINE__), memrealloc(__VA_ARGS__))
+#define array_reserve(...) (Alloc_Site_Scope(__FILE__, __LINE__), array_reserve(__VA_ARGS__))
+#define array_push(...) (Alloc_Site_Scope(__FILE__, __LINE__), array_push(__VA_ARGS__))
+#define array_append(...) (Alloc_Site_Scope(__FILE__, __LINE__), array_append(__VA_ARGS__))
+#define hash_map_reserve(...) (Alloc_Site_Scope(__FILE__, __LINE__), hash_map_reserve(__VA_ARGS__))
+#define hash_map_put(...) (Alloc_Site_Scope(__FILE__, __LINE__), hash_map_put(__VA_ARGS__))
+#define slot_map_reserve(...) (Alloc_Site_Scope(__FILE__, __LINE__), slot_map_reserve(__VA_ARGS__))
+#define slot_map_add(...) (Alloc_Site_Scope(__FILE__, __LINE__), slot_map_add(__VA_ARGS__))
+#endif
+
 #define LVL5_CONTEXT
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef LVL5_MATH
 
 #include <math.h>
+#include <string.h>
 #include "lvl5_types.h"
 
 
@@ -484,6 +485,24 @@ T sqr(T a) {
 
 
 
+// NOTE: 8-wide types come in several backends with the same interface.
+// AVX2 is the native one, SSE/NEON run each 8x value as two 4-wide halves,
+// scalar is plain arrays the compiler is free to auto-vectorize.
+// Define one of the LVL5_SIMD_* macros before including to force a backend.
+#if !defined(LVL5_SIMD_AVX2) && !defined(LVL5_SIMD_SSE) && !defined(LVL5_SIMD_NEON) && !defined(LVL5_SIMD_SCALAR)
+#if defined(__AVX2__)
+#define LVL5_SIMD_AVX2
+#elif defined(__SSE4_1__)
+#define LVL5_SIMD_SSE
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define LVL5_SIMD_NEON
+#else
+#define LVL5_SIMD_SCALAR
+#endif
+#endif
+
+#if defined(LVL5_SIMD_AVX2)
+
 #include <immintrin.h>
 #include <avxintrin.h>
 
@@ -494,191 +513,670 @@ f32_8x set8(f32 a) {
   return result;
 }
 
-union V2_8x {
-  struct {
-    __m256 x, y;
-  };
+f32_8x lane_index_8x() {
+  f32_8x result = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+  return result;
+}
+
+f32_8x floor(f32_8x a) {
+  f32_8x result = _mm256_floor_ps(a);
+  return result;
+}
+
+f32_8x sqrt(f32_8x a) {
+  f32_8x result = _mm256_sqrt_ps(a);
+  return result;
+}
+
+f32_8x min(f32_8x a, f32_8x b) {
+  f32_8x result = _mm256_min_ps(a, b);
+  return result;
+}
+
+f32_8x max(f32_8x a, f32_8x b) {
+  f32_8x result = _mm256_max_ps(a, b);
+  return result;
+}
+
+f32_8x load8(f32 *ptr) {
+  f32_8x result = _mm256_loadu_ps(ptr);
+  return result;
+}
+
+void store8(f32 *ptr, f32_8x a) {
+  _mm256_storeu_ps(ptr, a);
+}
+
+
+union i32_8x {
+  __m256i full;
+  i32 e[8];
 };
 
-V2_8x set8(V2 a) {
-  V2_8x result = {
-    .x = set8(a.x),
-    .y = set8(a.y),
-  };
+i32_8x mask_ge(f32_8x a, f32_8x b) {
+  i32_8x result = {_mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_GE_OQ))};
   return result;
 }
 
-V2_8x operator+(V2_8x a, V2_8x b) {
-  V2_8x result = { 
-    .x = _mm256_add_ps(a.x, b.x),
-    .y = _mm256_add_ps(a.y, b.y),
-  };
+i32_8x mask_lt(f32_8x a, f32_8x b) {
+  i32_8x result = {_mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ))};
   return result;
 }
 
-V2_8x operator+=(V2_8x &a, V2_8x b) {
-  a = a + b;
-  return a;
+i32_8x set8i(i32 v) {
+  i32_8x result = {_mm256_set1_epi32(v)};
+  return result;
 }
 
-V2_8x operator*(V2_8x a, V2_8x b) {
-  V2_8x result = { 
-    .x = _mm256_mul_ps(a.x, b.x),
-    .y = _mm256_mul_ps(a.y, b.y),
-  };
+i32_8x operator+(i32_8x a, i32_8x b) {
+  i32_8x result = {_mm256_add_epi32(a.full, b.full)};
   return result;
 }
 
-V2_8x operator/(f32 a, V2_8x b) {
-  V2_8x result = { 
-    .x = a / b.x,
-    .y = a / b.y,
-  };
+i32_8x operator*(i32_8x a, i32 b) {
+  i32_8x result = {_mm256_mullo_epi32(a.full, set8i(b).full)};
   return result;
 }
 
-V2_8x operator-(V2_8x a, V2_8x b) {
-  V2_8x result = { 
-    .x = _mm256_sub_ps(a.x, b.x),
-    .y = _mm256_sub_ps(a.y, b.y),
-  };
+i32_8x operator&(i32_8x a, i32_8x b) {
+  i32_8x result = {_mm256_and_si256(a.full, b.full)};
   return result;
 }
 
-f32_8x dot(V2_8x a, V2_8x b) {
-   f32_8x result =  _mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y));
-   return result;
+i32_8x operator|(i32_8x a, i32_8x b) {
+  i32_8x result = {_mm256_or_si256(a.full, b.full)};
+  return result;
 }
 
-f32_8x cross(V2_8x a, V2_8x b) {
-  f32_8x result = a.x*b.y - b.x*a.y;
+i32_8x operator<<(i32_8x a, i32 b) {
+  i32_8x result = {_mm256_slli_epi32(a.full, b)};
   return result;
 }
 
-V2_8x perp(V2_8x a) {
-  V2_8x result = {-a.y, a.x};
+i32_8x operator>>(i32_8x a, i32 b) {
+  i32_8x result = {_mm256_srli_epi32(a.full, b)};
   return result;
 }
 
-V2_8x floor(V2_8x a) {
-  V2_8x result = {
-    .x = _mm256_floor_ps(a.x),
-    .y = _mm256_floor_ps(a.y),
-  };
+void mask_store_i32_8x(void *ptr, i32_8x mask, i32_8x data) {
+  _mm256_maskstore_epi32((int *)ptr, mask.full, data.full);
+}
+
+i32_8x mask_load_i32_8x(void *ptr, i32_8x mask) {
+  i32_8x result = {_mm256_maskload_epi32((int *)ptr, mask.full)};
   return result;
 }
 
-V2_8x fract(V2_8x a) {
-  V2_8x result = {
-    .x = a.x - _mm256_floor_ps(a.x),
-    .y = a.y - _mm256_floor_ps(a.y),
-  };
+i32_8x load_i32_8x(void *ptr) {
+  i32_8x result = {_mm256_load_si256((__m256i *)ptr)};
   return result;
 }
 
-V2_8x clamp01(V2_8x a) {
-  V2_8x result = {
-    .x = _mm256_min_ps(_mm256_max_ps(set8(0), a.x), set8(1)),
-    .y = _mm256_min_ps(_mm256_max_ps(set8(0), a.y), set8(1)),
-  };
+i32_8x gather_i32(void *ptr, i32_8x offset, i32_8x mask) {
+  i32_8x result = {_mm256_mask_i32gather_epi32(set8i(0).full, (int *)ptr, offset.full, mask.full, sizeof(i32))};
   return result;
 }
 
+i32_8x to_i32_8x(f32_8x a) {
+  i32_8x result = {_mm256_cvtps_epi32(a)};
+  return result;
+}
+
+f32_8x to_f32_8x(i32_8x a) {
+  f32_8x result = _mm256_cvtepi32_ps(a.full);
+  return result;
+}
+
+#elif defined(LVL5_SIMD_SSE) || defined(LVL5_SIMD_NEON)
+
+#define LVL5_SIMD_2X4
+
+#if defined(LVL5_SIMD_SSE)
+
+#include <smmintrin.h>
+
+typedef __m128 f32_4x;
+typedef __m128i i32_4x;
+
+f32_4x set4(f32 a) { return _mm_set1_ps(a); }
+f32_4x add4(f32_4x a, f32_4x b) { return _mm_add_ps(a, b); }
+f32_4x sub4(f32_4x a, f32_4x b) { return _mm_sub_ps(a, b); }
+f32_4x mul4(f32_4x a, f32_4x b) { return _mm_mul_ps(a, b); }
+f32_4x div4(f32_4x a, f32_4x b) { return _mm_div_ps(a, b); }
+f32_4x min4(f32_4x a, f32_4x b) { return _mm_min_ps(a, b); }
+f32_4x max4(f32_4x a, f32_4x b) { return _mm_max_ps(a, b); }
+f32_4x floor4(f32_4x a) { return _mm_floor_ps(a); }
+f32_4x sqrt4(f32_4x a) { return _mm_sqrt_ps(a); }
+i32_4x ge4(f32_4x a, f32_4x b) { return _mm_castps_si128(_mm_cmpge_ps(a, b)); }
+i32_4x lt4(f32_4x a, f32_4x b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+i32_4x to_i32_4x(f32_4x a) { return _mm_cvtps_epi32(a); }
+f32_4x to_f32_4x(i32_4x a) { return _mm_cvtepi32_ps(a); }
+
+i32_4x set4i(i32 a) { return _mm_set1_epi32(a); }
+i32_4x add4i(i32_4x a, i32_4x b) { return _mm_add_epi32(a, b); }
+i32_4x mul4i(i32_4x a, i32_4x b) { return _mm_mullo_epi32(a, b); }
+i32_4x and4i(i32_4x a, i32_4x b) { return _mm_and_si128(a, b); }
+i32_4x or4i(i32_4x a, i32_4x b) { return _mm_or_si128(a, b); }
+i32_4x shl4i(i32_4x a, i32 b) { return _mm_sll_epi32(a, _mm_cvtsi32_si128(b)); }
+i32_4x shr4i(i32_4x a, i32 b) { return _mm_srl_epi32(a, _mm_cvtsi32_si128(b)); }
+i32_4x load4i(void *ptr) { return _mm_loadu_si128((__m128i *)ptr); }
+f32_4x load4(f32 *ptr) { return _mm_loadu_ps(ptr); }
+void store4(f32 *ptr, f32_4x a) { _mm_storeu_ps(ptr, a); }
+
+#else
+
+#include <arm_neon.h>
+
+typedef float32x4_t f32_4x;
+typedef int32x4_t i32_4x;
+
+f32_4x set4(f32 a) { return vdupq_n_f32(a); }
+f32_4x add4(f32_4x a, f32_4x b) { return vaddq_f32(a, b); }
+f32_4x sub4(f32_4x a, f32_4x b) { return vsubq_f32(a, b); }
+f32_4x mul4(f32_4x a, f32_4x b) { return vmulq_f32(a, b); }
+f32_4x div4(f32_4x a, f32_4x b) { return vdivq_f32(a, b); }
+// NOTE: vminq/vmaxq order -0 below +0 and propagate NaN, minps/maxps
+// return b unless the compare holds, select to match them
+f32_4x min4(f32_4x a, f32_4x b) { return vbslq_f32(vcltq_f32(a, b), a, b); }
+f32_4x max4(f32_4x a, f32_4x b) { return vbslq_f32(vcgtq_f32(a, b), a, b); }
+f32_4x floor4(f32_4x a) { return vrndmq_f32(a); }
+f32_4x sqrt4(f32_4x a) { return vsqrtq_f32(a); }
+i32_4x ge4(f32_4x a, f32_4x b) { return vreinterpretq_s32_u32(vcgeq_f32(a, b)); }
+i32_4x lt4(f32_4x a, f32_4x b) { return vreinterpretq_s32_u32(vcltq_f32(a, b)); }
+i32_4x to_i32_4x(f32_4x a) { return vcvtnq_s32_f32(a); }
+f32_4x to_f32_4x(i32_4x a) { return vcvtq_f32_s32(a); }
+
+i32_4x set4i(i32 a) { return vdupq_n_s32((int32_t)a); }
+i32_4x add4i(i32_4x a, i32_4x b) { return vaddq_s32(a, b); }
+i32_4x mul4i(i32_4x a, i32_4x b) { return vmulq_s32(a, b); }
+i32_4x and4i(i32_4x a, i32_4x b) { return vandq_s32(a, b); }
+i32_4x or4i(i32_4x a, i32_4x b) { return vorrq_s32(a, b); }
+i32_4x shl4i(i32_4x a, i32 b) { return vshlq_s32(a, vdupq_n_s32((int32_t)b)); }
+i32_4x shr4i(i32_4x a, i32 b) {
+  return vreinterpretq_s32_u32(vshlq_u32(vreinterpretq_u32_s32(a), vdupq_n_s32(-(int32_t)b)));
+}
+i32_4x load4i(void *ptr) { return vld1q_s32((int32_t *)ptr); }
+f32_4x load4(f32 *ptr) { return vld1q_f32(ptr); }
+void store4(f32 *ptr, f32_4x a) { vst1q_f32(ptr, a); }
+
+#endif
+
+struct f32_8x {
+  f32_4x lo, hi;
+};
+
+f32_8x set8(f32 a) {
+  f32_8x result = {set4(a), set4(a)};
+  return result;
+}
+
+f32_8x lane_index_8x() {
+  f32 lanes[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+  f32_8x result;
+  memcpy(&result.lo, lanes, sizeof(result.lo));
+  memcpy(&result.hi, lanes + 4, sizeof(result.hi));
+  return result;
+}
+
+f32_8x operator+(f32_8x a, f32_8x b) {
+  f32_8x result = {add4(a.lo, b.lo), add4(a.hi, b.hi)};
+  return result;
+}
+
+f32_8x operator-(f32_8x a, f32_8x b) {
+  f32_8x result = {sub4(a.lo, b.lo), sub4(a.hi, b.hi)};
+  return result;
+}
+
+f32_8x operator*(f32_8x a, f32_8x b) {
+  f32_8x result = {mul4(a.lo, b.lo), mul4(a.hi, b.hi)};
+  return result;
+}
+
+f32_8x operator/(f32_8x a, f32_8x b) {
+  f32_8x result = {div4(a.lo, b.lo), div4(a.hi, b.hi)};
+  return result;
+}
+
+f32_8x floor(f32_8x a) {
+  f32_8x result = {floor4(a.lo), floor4(a.hi)};
+  return result;
+}
+
+f32_8x sqrt(f32_8x a) {
+  f32_8x result = {sqrt4(a.lo), sqrt4(a.hi)};
+  return result;
+}
+
+f32_8x min(f32_8x a, f32_8x b) {
+  f32_8x result = {min4(a.lo, b.lo), min4(a.hi, b.hi)};
+  return result;
+}
+
+f32_8x max(f32_8x a, f32_8x b) {
+  f32_8x result = {max4(a.lo, b.lo), max4(a.hi, b.hi)};
+  return result;
+}
+
+f32_8x load8(f32 *ptr) {
+  f32_8x result = {load4(ptr), load4(ptr + 4)};
+  return result;
+}
+
+void store8(f32 *ptr, f32_8x a) {
+  store4(ptr, a.lo);
+  store4(ptr + 4, a.hi);
+}
+
 
 union i32_8x {
-  __m256i full;
+  i32_4x half[2];
   i32 e[8];
 };
 
+i32_8x mask_ge(f32_8x a, f32_8x b) {
+  i32_8x result = {{ge4(a.lo, b.lo), ge4(a.hi, b.hi)}};
+  return result;
+}
+
+i32_8x mask_lt(f32_8x a, f32_8x b) {
+  i32_8x result = {{lt4(a.lo, b.lo), lt4(a.hi, b.hi)}};
+  return result;
+}
+
 i32_8x set8i(i32 v) {
-  i32_8x result = {_mm256_set1_epi32(v)};
+  i32_8x result = {{set4i(v), set4i(v)}};
   return result;
 }
 
 i32_8x operator+(i32_8x a, i32_8x b) {
-  i32_8x result = {_mm256_add_epi32(a.full, b.full)};
+  i32_8x result = {{add4i(a.half[0], b.half[0]), add4i(a.half[1], b.half[1])}};
   return result;
 }
 
 i32_8x operator*(i32_8x a, i32 b) {
-  i32_8x result = {_mm256_mullo_epi32(a.full, set8i(b).full)};
+  i32_8x result = {{mul4i(a.half[0], set4i(b)), mul4i(a.half[1], set4i(b))}};
   return result;
 }
 
-i32_8x operator&(i32_8x a, u32 b) {
-  i32_8x result = {
-    .full = _mm256_and_si256(a.full, set8i((i32)b).full),
-  };
+i32_8x operator&(i32_8x a, i32_8x b) {
+  i32_8x result = {{and4i(a.half[0], b.half[0]), and4i(a.half[1], b.half[1])}};
   return result;
 }
 
-i32_8x operator&(i32_8x a, i32_8x b) {
-  i32_8x result = {
-    .full = a.full & b.full,
-  };
+i32_8x operator|(i32_8x a, i32_8x b) {
+  i32_8x result = {{or4i(a.half[0], b.half[0]), or4i(a.half[1], b.half[1])}};
   return result;
 }
 
-i32_8x operator|(i32_8x a, u32 b) {
-  i32_8x result = {
-    .full = a.full | b,
-  };
+i32_8x operator<<(i32_8x a, i32 b) {
+  i32_8x result = {{shl4i(a.half[0], b), shl4i(a.half[1], b)}};
+  return result;
+}
+
+i32_8x operator>>(i32_8x a, i32 b) {
+  i32_8x result = {{shr4i(a.half[0], b), shr4i(a.half[1], b)}};
+  return result;
+}
+
+// NOTE: no maskload/maskstore/gather below AVX2, so these go lane by lane
+void mask_store_i32_8x(void *ptr, i32_8x mask, i32_8x data) {
+  i32 *dest = (i32 *)ptr;
+  for (i32 i = 0; i < 8; i++) {
+    if (mask.e[i] < 0) dest[i] = data.e[i];
+  }
+}
+
+i32_8x mask_load_i32_8x(void *ptr, i32_8x mask) {
+  i32_8x result;
+  for (i32 i = 0; i < 8; i++) {
+    result.e[i] = mask.e[i] < 0 ? ((i32 *)ptr)[i] : 0;
+  }
+  return result;
+}
+
+i32_8x load_i32_8x(void *ptr) {
+  i32_8x result = {{load4i(ptr), load4i((i32 *)ptr + 4)}};
+  return result;
+}
+
+i32_8x gather_i32(void *ptr, i32_8x offset, i32_8x mask) {
+  i32_8x result;
+  for (i32 i = 0; i < 8; i++) {
+    result.e[i] = mask.e[i] < 0 ? ((i32 *)ptr)[offset.e[i]] : 0;
+  }
+  return result;
+}
+
+i32_8x to_i32_8x(f32_8x a) {
+  i32_8x result = {{to_i32_4x(a.lo), to_i32_4x(a.hi)}};
+  return result;
+}
+
+f32_8x to_f32_8x(i32_8x a) {
+  f32_8x result = {to_f32_4x(a.half[0]), to_f32_4x(a.half[1])};
+  return result;
+}
+
+#else
+
+#define LVL5_SIMD_SCALAR_LOOP(expr) for (i32 i = 0; i < 8; i++) { expr; }
+
+struct f32_8x {
+  f32 e[8];
+};
+
+f32_8x set8(f32 a) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a);
+  return result;
+}
+
+f32_8x lane_index_8x() {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = (f32)i);
+  return result;
+}
+
+f32_8x operator+(f32_8x a, f32_8x b) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i] + b.e[i]);
+  return result;
+}
+
+f32_8x operator-(f32_8x a, f32_8x b) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i] - b.e[i]);
+  return result;
+}
+
+f32_8x operator*(f32_8x a, f32_8x b) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i]*b.e[i]);
+  return result;
+}
+
+f32_8x operator/(f32_8x a, f32_8x b) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i]/b.e[i]);
+  return result;
+}
+
+f32_8x floor(f32_8x a) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = floorf(a.e[i]));
+  return result;
+}
+
+f32_8x sqrt(f32_8x a) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = sqrtf(a.e[i]));
+  return result;
+}
+
+f32_8x min(f32_8x a, f32_8x b) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i] < b.e[i] ? a.e[i] : b.e[i]);
+  return result;
+}
+
+f32_8x max(f32_8x a, f32_8x b) {
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i] > b.e[i] ? a.e[i] : b.e[i]);
+  return result;
+}
+
+f32_8x load8(f32 *ptr) {
+  f32_8x result;
+  memcpy(result.e, ptr, sizeof(result.e));
+  return result;
+}
+
+void store8(f32 *ptr, f32_8x a) {
+  memcpy(ptr, a.e, sizeof(a.e));
+}
+
+
+union i32_8x {
+  i32 e[8];
+};
+
+i32_8x mask_ge(f32_8x a, f32_8x b) {
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i] >= b.e[i] ? -1 : 0);
+  return result;
+}
+
+i32_8x mask_lt(f32_8x a, f32_8x b) {
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i] < b.e[i] ? -1 : 0);
+  return result;
+}
+
+i32_8x set8i(i32 v) {
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = v);
+  return result;
+}
+
+i32_8x operator+(i32_8x a, i32_8x b) {
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = (i32)((u32)a.e[i] + (u32)b.e[i]));
+  return result;
+}
+
+i32_8x operator*(i32_8x a, i32 b) {
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = (i32)((u32)a.e[i]*(u32)b));
+  return result;
+}
+
+i32_8x operator&(i32_8x a, i32_8x b) {
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i] & b.e[i]);
   return result;
 }
 
 i32_8x operator|(i32_8x a, i32_8x b) {
-  i32_8x result = {
-    .full = a.full | b.full,
-  };
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = a.e[i] | b.e[i]);
   return result;
 }
 
 i32_8x operator<<(i32_8x a, i32 b) {
-  i32_8x result = {
-    .full = _mm256_slli_epi32(a.full, b),
-  };
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = (i32)((u32)a.e[i] << b));
   return result;
 }
 
 i32_8x operator>>(i32_8x a, i32 b) {
-  i32_8x result = {
-    .full = _mm256_srli_epi32(a.full, b),
-  };
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = (i32)((u32)a.e[i] >> b));
   return result;
 }
 
 void mask_store_i32_8x(void *ptr, i32_8x mask, i32_8x data) {
-  _mm256_maskstore_epi32((int *)ptr, mask.full, data.full);
+  i32 *dest = (i32 *)ptr;
+  LVL5_SIMD_SCALAR_LOOP(if (mask.e[i] < 0) dest[i] = data.e[i]);
+}
+
+i32_8x mask_load_i32_8x(void *ptr, i32_8x mask) {
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = mask.e[i] < 0 ? ((i32 *)ptr)[i] : 0);
+  return result;
 }
 
 i32_8x load_i32_8x(void *ptr) {
-  i32_8x result = {_mm256_load_si256((__m256i *)ptr)};
+  i32_8x result;
+  memcpy(result.e, ptr, sizeof(result.e));
   return result;
 }
 
 i32_8x gather_i32(void *ptr, i32_8x offset, i32_8x mask) {
-  i32_8x result = {_mm256_mask_i32gather_epi32(set8i(0).full, (int *)ptr, offset.full, mask.full, sizeof(i32))};
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = mask.e[i] < 0 ? ((i32 *)ptr)[offset.e[i]] : 0);
   return result;
 }
 
+// NOTE: matches cvtps_epi32, which rounds to nearest even
 i32_8x to_i32_8x(f32_8x a) {
-  i32_8x result = {_mm256_cvtps_epi32(a)};
+  i32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = (i32)nearbyintf(a.e[i]));
   return result;
 }
 
 f32_8x to_f32_8x(i32_8x a) {
-  f32_8x result = _mm256_cvtepi32_ps(a.full);
+  f32_8x result;
+  LVL5_SIMD_SCALAR_LOOP(result.e[i] = (f32)a.e[i]);
+  return result;
+}
+
+#undef LVL5_SIMD_SCALAR_LOOP
+
+#endif
+
+
+#if !defined(LVL5_SIMD_AVX2)
+// NOTE: AVX2 gets these for free from vector extensions
+f32_8x operator-(f32_8x a) {
+  // -0 - a flips the sign of zeros too, 0 - a wouldn't
+  f32_8x result = set8(-0.0f) - a;
+  return result;
+}
+
+f32_8x operator+(f32_8x a, f32 b) { return a + set8(b); }
+f32_8x operator+(f32 a, f32_8x b) { return set8(a) + b; }
+f32_8x operator-(f32_8x a, f32 b) { return a - set8(b); }
+f32_8x operator-(f32 a, f32_8x b) { return set8(a) - b; }
+f32_8x operator*(f32_8x a, f32 b) { return a*set8(b); }
+f32_8x operator*(f32 a, f32_8x b) { return set8(a)*b; }
+f32_8x operator/(f32_8x a, f32 b) { return a/set8(b); }
+f32_8x operator/(f32 a, f32_8x b) { return set8(a)/b; }
+
+f32_8x operator+=(f32_8x &a, f32_8x b) {
+  a = a + b;
+  return a;
+}
+#endif
+
+
+i32_8x operator&(i32_8x a, u32 b) {
+  i32_8x result = a & set8i((i32)b);
+  return result;
+}
+
+i32_8x operator|(i32_8x a, u32 b) {
+  i32_8x result = a | set8i((i32)b);
   return result;
 }
 
+
+union V2_8x {
+  struct {
+    f32_8x x, y;
+  };
+};
+
+V2_8x set8(V2 a) {
+  V2_8x result = {
+    .x = set8(a.x),
+    .y = set8(a.y),
+  };
+  return result;
+}
+
+V2_8x operator+(V2_8x a, V2_8x b) {
+  V2_8x result = { 
+    .x = a.x + b.x,
+    .y = a.y + b.y,
+  };
+  return result;
+}
+
+V2_8x operator+=(V2_8x &a, V2_8x b) {
+  a = a + b;
+  return a;
+}
+
+V2_8x operator*(V2_8x a, V2_8x b) {
+  V2_8x result = { 
+    .x = a.x*b.x,
+    .y = a.y*b.y,
+  };
+  return result;
+}
+
+V2_8x operator/(f32 a, V2_8x b) {
+  V2_8x result = { 
+    .x = a / b.x,
+    .y = a / b.y,
+  };
+  return result;
+}
+
+V2_8x operator-(V2_8x a, V2_8x b) {
+  V2_8x result = { 
+    .x = a.x - b.x,
+    .y = a.y - b.y,
+  };
+  return result;
+}
+
+f32_8x dot(V2_8x a, V2_8x b) {
+   f32_8x result = a.x*b.x + a.y*b.y;
+   return result;
+}
+
+f32_8x cross(V2_8x a, V2_8x b) {
+  f32_8x result = a.x*b.y - b.x*a.y;
+  return result;
+}
+
+V2_8x perp(V2_8x a) {
+  V2_8x result = {-a.y, a.x};
+  return result;
+}
+
+V2_8x floor(V2_8x a) {
+  V2_8x result = {
+    .x = floor(a.x),
+    .y = floor(a.y),
+  };
+  return result;
+}
+
+V2_8x fract(V2_8x a) {
+  V2_8x result = {
+    .x = a.x - floor(a.x),
+    .y = a.y - floor(a.y),
+  };
+  return result;
+}
+
+V2_8x clamp01(V2_8x a) {
+  V2_8x result = {
+    .x = min(max(set8(0), a.x), set8(1)),
+    .y = min(max(set8(0), a.y), set8(1)),
+  };
+  return result;
+}
+
+// all-ones in lanes where 0 <= uv < 1 on both axes
+i32_8x inside_unit_square_mask(V2_8x uv) {
+  i32_8x result = mask_ge(uv.x, set8(0)) & mask_lt(uv.x, set8(1)) &
+    mask_ge(uv.y, set8(0)) & mask_lt(uv.y, set8(1));
+  return result;
+}
+
+
 struct V2i_8x {
   i32_8x x, y;
 };
 
 V2i_8x v2i_8x(V2_8x a) {
   V2i_8x result = {
-    .x = _mm256_cvtps_epi32(a.x),
-    .y = _mm256_cvtps_epi32(a.y),
+    .x = to_i32_8x(a.x),
+    .y = to_i32_8x(a.y),
   };
   return result;
 }
@@ -754,6 +1252,17 @@ Mat2 mat2(Mat4 m) {
   return result;
 }
 
+f32 det(Mat2 m) {
+  f32 result = m.a*m.d - m.b*m.c;
+  return result;
+}
+
+Mat2 inverse(Mat2 m) {
+  f32 inv_det = 1/det(m);
+  Mat2 result = {m.d*inv_det, -m.b*inv_det, -m.c*inv_det, m.a*inv_det};
+  return result;
+}
+
 
 struct Mat2_8x {
   f32_8x a, b, c, d;
@@ -798,5 +1307,120 @@ Mat2_8x inverse(Mat2_8x m) {
   return result;
 }
 
+
+// NOTE: sin(x) = (-1)^q*sin(x - q*pi) with q = round(x/pi), and the
+// remainder in [-pi/2, pi/2] goes through a taylor polynomial (~1e-7 error)
+f32_8x sin(f32_8x x) {
+  f32_8x q = floor(x*(1/PI32) + 0.5f);
+  f32_8x r = x - q*PI32;
+  f32_8x r2 = r*r;
+  f32_8x poly = 1 + r2*(-1/6.0f + r2*(1/120.0f + r2*(-1/5040.0f + r2*(1/362880.0f + r2*(-1/39916800.0f)))));
+  f32_8x sign = 1 - 2*(q - 2*floor(q*0.5f));
+  f32_8x result = sign*r*poly;
+  return result;
+}
+
+f32_8x cos(f32_8x x) {
+  f32_8x result = sin(x + PI32*0.5f);
+  return result;
+}
+
+
+// NOTE: structure-of-arrays batch operations, 8 elements per iteration.
+// The tail block is staged through a zero-padded copy, so arrays only
+// need to hold count elements.
+struct V2_SoA {
+  f32 *x;
+  f32 *y;
+};
+
+struct Rect2_SoA {
+  f32 *min_x;
+  f32 *min_y;
+  f32 *max_x;
+  f32 *max_y;
+};
+
+f32_8x load8(f32 *ptr, u32 count) {
+  f32_8x result;
+  if (count >= 8) {
+    result = load8(ptr);
+  } else {
+    f32 padded[8] = {};
+    memcpy(padded, ptr, sizeof(f32)*count);
+    result = load8(padded);
+  }
+  return result;
+}
+
+void store8(f32 *ptr, f32_8x a, u32 count) {
+  if (count >= 8) {
+    store8(ptr, a);
+  } else {
+    f32 padded[8];
+    store8(padded, a);
+    memcpy(ptr, padded, sizeof(f32)*count);
+  }
+}
+
+V2_8x load8(V2_SoA a, u32 index, u32 count) {
+  V2_8x result = {
+    .x = load8(a.x + index, count - index),
+    .y = load8(a.y + index, count - index),
+  };
+  return result;
+}
+
+void store8(V2_SoA a, u32 index, u32 count, V2_8x v) {
+  store8(a.x + index, v.x, count - index);
+  store8(a.y + index, v.y, count - index);
+}
+
+// oriented rects as origin corner + two axes spanning the full size
+void rotate_rects(V2_SoA center, V2_SoA size, f32 *angle,
+                  V2_SoA origin, V2_SoA x_axis, V2_SoA y_axis, u32 count)
+{
+  for (u32 i = 0; i < count; i += 8) {
+    V2_8x c = load8(center, i, count);
+    V2_8x s = load8(size, i, count);
+    f32_8x a = load8(angle + i, count - i);
+    f32_8x sin_a = sin(a);
+    f32_8x cos_a = cos(a);
+
+    V2_8x x = {cos_a*s.x, sin_a*s.x};
+    V2_8x y = {-sin_a*s.y, cos_a*s.y};
+    V2_8x half = {set8(0.5f), set8(0.5f)};
+    V2_8x o = c - x*half - y*half;
+
+    store8(origin, i, count, o);
+    store8(x_axis, i, count, x);
+    store8(y_axis, i, count, y);
+  }
+}
+
+// axis-aligned bounds of the parallelograms origin + [0, 1]*x_axis + [0, 1]*y_axis
+void get_bounds(V2_SoA origin, V2_SoA x_axis, V2_SoA y_axis, Rect2_SoA result, u32 count) {
+  for (u32 i = 0; i < count; i += 8) {
+    V2_8x o = load8(origin, i, count);
+    V2_8x x = load8(x_axis, i, count);
+    V2_8x y = load8(y_axis, i, count);
+
+    f32_8x zero = set8(0);
+    V2_8x lo = {
+      .x = o.x + min(x.x, zero) + min(y.x, zero),
+      .y = o.y + min(x.y, zero) + min(y.y, zero),
+    };
+    V2_8x hi = {
+      .x = o.x + max(x.x, zero) + max(y.x, zero),
+      .y = o.y + max(x.y, zero) + max(y.y, zero),
+    };
+
+    store8(result.min_x + i, lo.x, count - i);
+    store8(result.min_y + i, lo.y, count - i);
+    store8(result.max_x + i, hi.x, count - i);
+    store8(result.max_y + i, hi.y, count - i);
+  }
+}
+
 #define LVL5_MATH
-#endif
\ No newline at end of file
+#endif
@@ -34,6 +34,7 @@ typedef u64 Mem_Size;
 #define PI32 3.14159265358979323846f
 #define I32_MAX 0x7FFFFFFF
 #define I32_MIN 0xFFFFFFFF
+#define U32_MAX 0xFFFFFFFF
 
 
 
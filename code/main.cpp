@@ -36,6 +36,7 @@ File_Buffer win32_read_entire_file(char *file_name) {
     DWORD bytes_read = 0;
 
     ReadFile(file, file_memory, file_size, &bytes_read, nullptr);
+    CloseHandle(file);
 
     File_Buffer result;
     result.data = file_memory;
@@ -151,6 +152,7 @@ Bitmap win32_read_bmp(char *file_name) {
       }
     }
 
+    memfree(file.data);
     return result;
 }
 
@@ -202,7 +204,7 @@ Texture_Atlas texture_atlas_make_from_bitmaps(Bitmap *bitmaps, i32 bitmap_count,
   return result;
 }
 
-Font os_load_font(char *file_name, char *font_name, i32 font_size) {
+Font os_load_font(char *file_name, char *font_name, i32 font_size, bool lcd = false) {
   Font font = {0};
   
   HDC device_context = CreateCompatibleDC(GetDC(nullptr));
@@ -221,7 +223,7 @@ Font os_load_font(char *file_name, char *font_name, i32 font_size) {
     DEFAULT_CHARSET,
     OUT_DEFAULT_PRECIS,
     CLIP_DEFAULT_PRECIS,
-    ANTIALIASED_QUALITY,
+    lcd ? CLEARTYPE_QUALITY : ANTIALIASED_QUALITY,
     DEFAULT_PITCH|FF_DONTCARE,
     font_name);
   
@@ -265,10 +267,14 @@ Font os_load_font(char *file_name, char *font_name, i32 font_size) {
   char last_codepoint = '~';
   
   i32 codepoint_count = (last_codepoint - first_codepoint + 1);
-  Bitmap *codepoint_bitmaps = (Bitmap*)scratch_alloc(sizeof(Bitmap)*(u32)(codepoint_count + 1));
+  i32 phase_count = FONT_SUBPIXEL_PHASES;
+  i32 glyph_bitmap_count = codepoint_count*phase_count;
+  Bitmap *codepoint_bitmaps = (Bitmap*)scratch_alloc(sizeof(Bitmap)*(u32)(glyph_bitmap_count + 1));
   // 1 extra bitmap for white pixel
   
   font = {
+    .subpixel_phases = phase_count,
+    .lcd = lcd,
     .first_codepoint = first_codepoint,
     .advance = (i8 *)memalloc(sizeof(i8)*(u32)codepoint_count),
     .kerning = (i8 *)memalloc(sizeof(i8)*(u32)(codepoint_count*codepoint_count)),
@@ -330,13 +336,23 @@ Font os_load_font(char *file_name, char *font_name, i32 font_size) {
     for (i32 y = 0; y < bmp.height; y++) {
       for (i32 x = 0; x < bmp.width; x++) {
         u32 src_pixel = font_buffer_pixels[(min_y + y)*font_buffer_width + min_x + x];
-        u8 intensity = (u8)((src_pixel & 0x00FF0000) >> 16);
-        Pixel new_pixel = pixel_u32(0xFF, 0xFF, 0xFF, intensity);
+        Pixel new_pixel;
+        if (lcd) {
+          new_pixel = pixel_u32((u8)(src_pixel >> 16), (u8)(src_pixel >> 8), (u8)src_pixel, 0xFF);
+        } else {
+          u8 intensity = (u8)((src_pixel & 0x00FF0000) >> 16);
+          new_pixel = pixel_u32(0xFF, 0xFF, 0xFF, intensity);
+        }
         bmp.data[y*bmp.width + x] = new_pixel;
       }
     }
     
-    codepoint_bitmaps[codepoint_index] = bmp;
+    Pixel empty_pixel = lcd ? pixel_u32(0, 0, 0, 0xFF) : pixel_u32(0xFF, 0xFF, 0xFF, 0);
+    codepoint_bitmaps[codepoint_index*phase_count] = bmp;
+    for (i32 phase = 1; phase < phase_count; phase++) {
+      codepoint_bitmaps[codepoint_index*phase_count + phase] =
+        make_subpixel_phase(bmp, (f32)phase/(f32)phase_count, empty_pixel);
+    }
     
     ABC abc = abcs[codepoint_index];
     i8 total_width = (i8)(abc.abcA + (i32)abc.abcB + (i32)abc.abcC);
@@ -351,15 +367,15 @@ Font os_load_font(char *file_name, char *font_name, i32 font_size) {
   white_bitmap.data[1] = {0xFFFFFFFF};
   white_bitmap.data[2] = {0xFFFFFFFF};
   white_bitmap.data[3] = {0xFFFFFFFF};
-  codepoint_bitmaps[codepoint_count] = white_bitmap;
+  codepoint_bitmaps[glyph_bitmap_count] = white_bitmap;
   
   font.line_spacing = (i8)((i32)metric->otmLineGap + metric->otmAscent - (i32)metric->otmDescent);
   font.line_height = (i8)metric->otmTextMetrics.tmHeight;
   font.descent = (i8)metric->otmTextMetrics.tmDescent;
-  font.atlas = texture_atlas_make_from_bitmaps(codepoint_bitmaps, codepoint_count+1, 512);
+  font.atlas = texture_atlas_make_from_bitmaps(codepoint_bitmaps, glyph_bitmap_count + 1, 512);
   
   DWORD kerning_pair_count = GetKerningPairs(device_context, I32_MAX, nullptr);
-  KERNINGPAIR *kerning_pairs = (KERNINGPAIR *)memalloc(sizeof(KERNINGPAIR)*kerning_pair_count);
+  KERNINGPAIR *kerning_pairs = (KERNINGPAIR *)scratch_alloc(sizeof(KERNINGPAIR)*kerning_pair_count);
   GetKerningPairs(device_context, kerning_pair_count, kerning_pairs);
   for (DWORD i = 0; i < kerning_pair_count; i++) {
     KERNINGPAIR pair = kerning_pairs[i];
@@ -458,6 +474,8 @@ struct Thread_Queue {
   volatile u32 read_cursor;
   volatile u32 completion_cursor;
   volatile u32 target_cursor;
+  // bumped by wait_for_all_tasks, no task of an older group is running
+  volatile u32 group_index;
   HANDLE semaphore;
 };
 
@@ -468,6 +486,25 @@ struct Thread {
 
 globalvar bool __run_threads = true;
 
+// Tasks see this as their scratch, on whatever thread runs them, the main
+// thread included. It is reset when a thread picks up the first task of a
+// new group, so scratch_alloc inside a Worker_Fn lives until the
+// wait_for_all_tasks that finishes its group.
+#define TASK_SCRATCH_RESERVE megabytes(256)
+globalvar thread_local Arena __task_scratch;
+globalvar thread_local u32 __task_scratch_group;
+
+void begin_task_scratch(Thread_Queue *queue) {
+  if (!__task_scratch.data) {
+    __task_scratch = make_arena(TASK_SCRATCH_RESERVE);
+    __task_scratch_group = queue->group_index;
+  }
+  if (__task_scratch_group != queue->group_index) {
+    arena_reset(&__task_scratch);
+    __task_scratch_group = queue->group_index;
+  }
+}
+
 bool do_thread_task(Thread_Queue *queue) {
   bool result = true;
 
@@ -477,6 +514,8 @@ bool do_thread_task(Thread_Queue *queue) {
     u32 new_read_cursor = (old_read_cursor + 1) % THREAD_QUEUE_CAPACITY;
     if (InterlockedCompareExchange(&queue->read_cursor, new_read_cursor, old_read_cursor) == old_read_cursor) {
       Thread_Queue_Item *item = queue->items + old_read_cursor;
+      begin_task_scratch(queue);
+      Context_Scope scope = push_scratch(&__task_scratch);
       item->fn(item->data);
       InterlockedIncrement(&queue->completion_cursor);
     }
@@ -490,6 +529,8 @@ bool do_thread_task(Thread_Queue *queue) {
 DWORD WINAPI thread_proc(void *data) {
   Thread *thread = (Thread *)data;
   Thread_Queue *queue = thread->queue;
+  // the context stack is thread_local, every worker starts its own
+  init_default_context();
   while (__run_threads) {
     bool did_task = do_thread_task(queue);
     if (!did_task) {
@@ -532,16 +573,578 @@ void wait_for_all_tasks(Thread_Queue *queue) {
   }
   queue->target_cursor = 0;
   queue->completion_cursor = 0;
+  queue->group_index++;
+}
+
+#ifdef NETLIST_BENCHMARK
+// Time bit-parallel evaluation of a generated 1M gate netlist with 1..N tasks per level.
+void win32_netlist_benchmark(Thread_Queue *queue, u32 logical_core_count) {
+  Netlist net;
+  netlist_generate(&net, 64, 1 << 20, 16, 12345);
+  u64 *values = (u64 *)memalloc(sizeof(u64)*netlist_signal_count(&net));
+  for (u32 in = 0; in < net.input_count; in++) {
+    netlist_set_input_lanes(&net, values, in, (u64)in*0x9E3779B97F4A7C15);
+  }
+
+  u32 run_count = 20;
+  f64 single_time = 0;
+  for (u32 task_count = 1; task_count <= logical_core_count; task_count++) {
+    netlist_eval_lanes_threaded(queue, task_count, &net, values);
+    f64 start = win32_get_time();
+    for (u32 run = 0; run < run_count; run++) {
+      netlist_eval_lanes_threaded(queue, task_count, &net, values);
+    }
+    f64 time = (win32_get_time() - start)/run_count;
+    if (task_count == 1) single_time = time;
+
+    char buffer[256];
+    sprintf_s(buffer, array_count(buffer), "netlist eval: %u tasks %0.3f ms, x%0.2f\n",
+              task_count, time*1000, single_time/time);
+    OutputDebugStringA(buffer);
+  }
+
+  memfree(values);
+  netlist_free(&net);
+}
+
+// Export a random design of 1M ANDs and 2M wires in both formats, load it
+// back and export what was loaded, which has to give the same bytes.
+// Everything lives on one arena, so the states go away in one free.
+void win32_netlist_io_benchmark() {
+  Arena arena = make_arena(gigabytes(8));
+  {
+    Context_Scope arena_scope = push_context(&arena);
+
+    u32 input_count = 64;
+    u32 and_count = 1 << 20;
+    State source;
+    init_state(&source);
+    Gate_Id top = make_composite(&source, GATE_NONE, "big", input_count, 1);
+    // each AND takes two random earlier signals
+    Gate_Id *signals = (Gate_Id *)memalloc(sizeof(Gate_Id)*(input_count + and_count));
+    for (u32 in = 0; in < input_count; in++) signals[in] = gate_in(&source, top, in);
+    u32 rng = 12345;
+    for (u32 i = 0; i < and_count; i++) {
+      Gate_Id gate = gate_and(&source, top);
+      for (u32 pin = 0; pin < 2; pin++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        connect(&source, {signals[rng % (input_count + i)], 0, gate, pin});
+      }
+      signals[input_count + i] = gate;
+    }
+    connect(&source, {signals[input_count + and_count - 1], 0, gate_out(&source, top, 0), 0});
+
+    for (u32 binary = 0; binary < 2; binary++) {
+      f64 start = win32_get_time();
+      u32 size;
+      u8 *data = netlist_export(&source, top, binary, &size);
+      f64 export_time = win32_get_time() - start;
+
+      State loaded;
+      init_state(&loaded);
+      Gate_Id loaded_top;
+      u32 error_line = 0;
+      start = win32_get_time();
+      Netlist_Load_Result result = binary ? netlist_load_binary(&loaded, data, size, &loaded_top) :
+                                            netlist_load_text(&loaded, (char *)data, size, &loaded_top, &error_line);
+      f64 load_time = win32_get_time() - start;
+      assert(result == NETLIST_LOAD_OK);
+
+      u32 round_trip_size;
+      u8 *round_trip = netlist_export(&loaded, loaded_top, binary, &round_trip_size);
+      bool identical = round_trip_size == size && memcmp(round_trip, data, size) == 0;
+
+      char buffer[256];
+      sprintf_s(buffer, array_count(buffer), "netlist %s: %0.1f MB, export %0.1f ms, load %0.1f ms, round trip %s\n",
+                binary ? "binary" : "text", (f64)size/(1024*1024), export_time*1000, load_time*1000,
+                identical ? "identical" : "DIFFERENT");
+      OutputDebugStringA(buffer);
+      assert(identical);
+    }
+  }
+  free_arena(&arena);
+}
+#endif
+
+#ifdef LVL5_CONTAINER_BENCHMARK
+// The stretchy buffer Array replaced, as the baseline: a header in front
+// of the elements, doubling through REALLOC and zeroing the new half.
+struct Bench_Sb_Header {
+  u32 count;
+  u32 capacity;
+};
+
+i32 *bench_sb_make(u32 capacity) {
+  Bench_Sb_Header *header = (Bench_Sb_Header *)memalloc(sizeof(Bench_Sb_Header) + sizeof(i32)*capacity);
+  memset(header, 0, sizeof(Bench_Sb_Header) + sizeof(i32)*capacity);
+  header->capacity = capacity;
+  i32 *result = (i32 *)(header + 1);
+  return result;
+}
+
+i32 *bench_sb_push(i32 *data, i32 value) {
+  Bench_Sb_Header *header = (Bench_Sb_Header *)data - 1;
+  if (header->count == header->capacity) {
+    Mem_Size old_bytes = sizeof(Bench_Sb_Header) + sizeof(i32)*header->capacity;
+    Mem_Size new_bytes = old_bytes + sizeof(i32)*header->capacity;
+    header = (Bench_Sb_Header *)memrealloc(header, new_bytes);
+    memset((byte *)header + old_bytes, 0, new_bytes - old_bytes);
+    header->capacity *= 2;
+  }
+  i32 *result = (i32 *)(header + 1);
+  result[header->count++] = value;
+  return result;
+}
+
+// 20M pushes from a capacity of 16, under whatever allocator is current
+void win32_array_benchmark(const char *allocator_name) {
+  u32 push_count = 20000000;
+  f64 start = win32_get_time();
+  i32 *sb = bench_sb_make(16);
+  for (u32 i = 0; i < push_count; i++) sb = bench_sb_push(sb, (i32)i);
+  f64 sb_time = win32_get_time() - start;
+
+  start = win32_get_time();
+  Array<i32> array = make_array<i32>(16);
+  for (u32 i = 0; i < push_count; i++) array_push(&array, (i32)i);
+  f64 array_time = win32_get_time() - start;
+
+  assert(array.count == push_count && ((Bench_Sb_Header *)sb - 1)->count == push_count);
+  assert(array[push_count - 1] == sb[push_count - 1]);
+  memfree((Bench_Sb_Header *)sb - 1);
+  array_free(&array);
+
+  char buffer[256];
+  sprintf_s(buffer, array_count(buffer), "array %s: sb_push %0.1f ms, array_push %0.1f ms\n",
+            allocator_name, sb_time*1000, array_time*1000);
+  OutputDebugStringA(buffer);
+}
+
+u32 bench_random(u32 *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// Lookups in a Hash_Map against the linear scans it replaced, with u32
+// keys and with definition names. Half the lookups hit, half miss.
+void win32_hash_map_benchmark() {
+  u32 sizes[] = {8, 64, 1024, 65536};
+  u32 query_count = 4096;
+  u32 *queries = (u32 *)memalloc(sizeof(u32)*query_count);
+  const char **name_queries = (const char **)memalloc(sizeof(const char *)*query_count);
+  char *miss_names = (char *)memalloc(16*query_count);
+  u32 rng = 12345;
+
+  for (u32 size_index = 0; size_index < array_count(sizes); size_index++) {
+    u32 size = sizes[size_index];
+    // hits are odd, misses even
+    u32 *keys = (u32 *)memalloc(sizeof(u32)*size);
+    char *name_data = (char *)memalloc(16*size);
+    const char **names = (const char **)memalloc(sizeof(const char *)*size);
+    Hash_Map<u32, u32> map = make_hash_map<u32, u32>(size);
+    Hash_Map<const char *, u32> name_map = make_hash_map<const char *, u32>(size);
+    for (u32 i = 0; i < size; i++) {
+      keys[i] = bench_random(&rng) | 1;
+      names[i] = name_data + 16*i;
+      sprintf_s(name_data + 16*i, 16, "def_%u", (unsigned)keys[i]);
+      hash_map_put(&map, keys[i], i);
+      hash_map_put(&name_map, names[i], i);
+    }
+    for (u32 i = 0; i < query_count; i++) {
+      u32 hit = keys[bench_random(&rng) % size];
+      u32 miss = bench_random(&rng) & ~1u;
+      queries[i] = i & 1 ? hit : miss;
+      sprintf_s(miss_names + 16*i, 16, "def_%u", (unsigned)miss);
+      name_queries[i] = i & 1 ? names[bench_random(&rng) % size] : miss_names + 16*i;
+    }
+
+    // scans are O(size), fewer of them keep the big sizes quick
+    u32 lookup_count = 1 << 22;
+    u32 scan_count = max((u32)(1 << 24)/size, query_count);
+    u64 sink = 0;
+
+    f64 start = win32_get_time();
+    for (u32 i = 0; i < scan_count; i++) {
+      u32 key = queries[i % query_count];
+      for (u32 k = 0; k < size; k++) {
+        if (keys[k] == key) {
+          sink += k;
+          break;
+        }
+      }
+    }
+    f64 scan_time = (win32_get_time() - start)/scan_count;
+
+    start = win32_get_time();
+    for (u32 i = 0; i < lookup_count; i++) {
+      u32 *value = hash_map_get(&map, queries[i % query_count]);
+      if (value) sink += *value;
+    }
+    f64 map_time = (win32_get_time() - start)/lookup_count;
+
+    start = win32_get_time();
+    for (u32 i = 0; i < scan_count/4; i++) {
+      const char *name = name_queries[i % query_count];
+      for (u32 k = 0; k < size; k++) {
+        if (strcmp(names[k], name) == 0) {
+          sink += k;
+          break;
+        }
+      }
+    }
+    f64 name_scan_time = (win32_get_time() - start)/(scan_count/4);
+
+    start = win32_get_time();
+    for (u32 i = 0; i < lookup_count/4; i++) {
+      u32 *value = hash_map_get(&name_map, name_queries[i % query_count]);
+      if (value) sink += *value;
+    }
+    f64 name_map_time = (win32_get_time() - start)/(lookup_count/4);
+
+    char buffer[256];
+    sprintf_s(buffer, array_count(buffer),
+              "hash map %u entries: u32 scan %0.1f ns, map %0.1f ns; name scan %0.1f ns, map %0.1f ns (%u)\n",
+              (unsigned)size, scan_time*1e9, map_time*1e9, name_scan_time*1e9, name_map_time*1e9,
+              (unsigned)(sink & 1));
+    OutputDebugStringA(buffer);
+
+    hash_map_free(&map);
+    hash_map_free(&name_map);
+    memfree(keys);
+    memfree(name_data);
+    memfree(names);
+  }
+
+  memfree(queries);
+  memfree(name_queries);
+  memfree(miss_names);
+}
+
+void win32_container_benchmark() {
+  win32_array_benchmark("heap");
+  Arena arena = make_arena(gigabytes(1));
+  {
+    Context_Scope arena_scope = push_context(&arena);
+    win32_array_benchmark("arena");
+  }
+  free_arena(&arena);
+  win32_hash_map_benchmark();
+}
+#endif
+
+#ifdef LVL5_SIMD_CONFORMANCE
+// NOTE: a build only ever contains one 8-wide backend, so the scalar build
+// is the reference: it records the lanes of every op to this file, and the
+// other backends replay the same random inputs and compare against it.
+// Run the LVL5_SIMD_SCALAR build first, from the same directory.
+#define SIMD_CONFORMANCE_FILE "simd_conformance.bin"
+#define SIMD_CONFORMANCE_ROUNDS 256
+
+struct Simd_Conformance {
+  u32 *lanes;
+  u32 lane_count;
+  u32 lane_capacity;
+  u32 *reference;
+  u32 reference_count;
+  u32 mismatch_count;
+  u32 round;
+  u32 random_state;
+};
+
+u32 simd_random(Simd_Conformance *conf) {
+  u32 x = conf->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  conf->random_state = x;
+  return x;
 }
 
+// width has to be a power of two: then width*t is exact and the result
+// is the same whether or not the compiler fuses it into an fma
+f32 simd_random_f32(Simd_Conformance *conf, f32 lo, f32 width) {
+  f32 t = (f32)(simd_random(conf) >> 8)*(1.0f/16777216.0f);
+  f32 result = lo + width*t;
+  return result;
+}
+
+// tolerance 0 means bit for bit. AVX2 uses vector extensions, so the
+// compiler may fuse a*b + c into an fma there, which only ops made of
+// several roundings (dot, Mat2_8x, sin/cos) can observe.
+void simd_record(Simd_Conformance *conf, const char *name, void *got, f32 tolerance) {
+  assert(conf->lane_count + 8 <= conf->lane_capacity);
+  u32 *got_bits = (u32 *)got;
+  memcpy(conf->lanes + conf->lane_count, got_bits, sizeof(u32)*8);
+  conf->lane_count += 8;
+  if (!conf->reference || conf->lane_count > conf->reference_count) return;
+
+  u32 *expected_bits = conf->reference + conf->lane_count - 8;
+
+  for (u32 lane = 0; lane < 8; lane++) {
+    if (got_bits[lane] == expected_bits[lane]) continue;
+    f32 got_value = ((f32 *)got_bits)[lane];
+    f32 expected_value = ((f32 *)expected_bits)[lane];
+    if (tolerance > 0 && fabsf(got_value - expected_value) <= tolerance) continue;
+
+    char buffer[256];
+    sprintf_s(buffer, array_count(buffer), "simd conformance: %s round %u lane %u got 0x%08x expected 0x%08x\n",
+              name, (unsigned)conf->round, (unsigned)lane, (unsigned)got_bits[lane], (unsigned)expected_bits[lane]);
+    OutputDebugStringA(buffer);
+    conf->mismatch_count++;
+  }
+}
+
+void simd_conformance_round(Simd_Conformance *conf) {
+  // inputs come straight from the generator, the only arithmetic on them
+  // is the op under test
+  alignas(32) f32 a[8], b[8], c[8], u[8], v[8];
+  alignas(32) i32 ia[8], ib[8], table[64];
+  bool halves = conf->round & 1;
+  for (u32 i = 0; i < 8; i++) {
+    a[i] = simd_random_f32(conf, -128, 256);
+    b[i] = simd_random_f32(conf, -128, 256);
+    if (halves) {
+      // ties for to_i32_8x, equal lanes for the compares, zeros
+      a[i] = (f32)((i32)(simd_random(conf) % 41) - 20)*0.5f;
+      b[i] = (f32)((i32)(simd_random(conf) % 41) - 20)*0.5f;
+    }
+    c[i] = simd_random_f32(conf, 0.5f, 64);
+    u[i] = simd_random_f32(conf, -0.5f, 2);
+    v[i] = simd_random_f32(conf, -0.5f, 2);
+    ia[i] = (i32)simd_random(conf);
+    ib[i] = (i32)simd_random(conf);
+  }
+  for (u32 i = 0; i < 64; i++) table[i] = (i32)simd_random(conf);
+
+  f32_8x va = load8(a);
+  f32_8x vb = load8(b);
+  f32_8x vc = load8(c);
+  i32_8x via = load_i32_8x(ia);
+  i32_8x vib = load_i32_8x(ib);
+  i32_8x mask = mask_lt(va, vb);
+  i32_8x offsets = via & 63u;
+  V2_8x vab = {va, vb};
+  V2_8x vcb = {vc, vb};
+  V2_8x vuv = {load8(u), load8(v)};
+
+#define RECORD_F32(name, wide, tolerance) { \
+    alignas(32) f32 lanes[8]; \
+    store8(lanes, wide); \
+    simd_record(conf, name, lanes, tolerance); \
+  }
+#define RECORD_I32(name, wide) { \
+    i32_8x lanes = wide; \
+    simd_record(conf, name, lanes.e, 0); \
+  }
+#define RECORD_V2(name, wide, tolerance) { \
+    V2_8x pair = wide; \
+    RECORD_F32(name ".x", pair.x, tolerance); \
+    RECORD_F32(name ".y", pair.y, tolerance); \
+  }
+#define RECORD_MAT2(name, wide, tolerance) { \
+    Mat2_8x m = wide; \
+    RECORD_F32(name ".a", m.a, tolerance); \
+    RECORD_F32(name ".b", m.b, tolerance); \
+    RECORD_F32(name ".c", m.c, tolerance); \
+    RECORD_F32(name ".d", m.d, tolerance); \
+  }
+
+  RECORD_F32("set8", set8(a[0]), 0);
+  RECORD_F32("lane_index_8x", lane_index_8x(), 0);
+  RECORD_F32("add", va + vb, 0);
+  RECORD_F32("sub", va - vb, 0);
+  RECORD_F32("mul", va*vb, 0);
+  RECORD_F32("div", va/vc, 0);
+  RECORD_F32("neg", -va, 0);
+  RECORD_F32("add_scalar", va + 2.5f, 0);
+  RECORD_F32("sub_scalar", 3.0f - va, 0);
+  RECORD_F32("mul_scalar", va*0.3f, 0);
+  RECORD_F32("div_scalar", 1.0f/vc, 0);
+  RECORD_F32("floor", floor(va), 0);
+  RECORD_F32("sqrt", sqrt(vc), 0);
+  // minps/maxps return the second operand unless the compare holds
+  RECORD_F32("min", min(va, vb), 0);
+  RECORD_F32("max", max(va, vb), 0);
+  RECORD_F32("to_f32_8x", to_f32_8x(via), 0);
+  RECORD_F32("sin", sin(va), 1e-4f);
+  RECORD_F32("cos", cos(va), 1e-4f);
+
+  RECORD_I32("mask_ge", mask_ge(va, vb));
+  RECORD_I32("mask_lt", mask);
+  RECORD_I32("to_i32_8x", to_i32_8x(va));
+  RECORD_I32("set8i", set8i(ia[0]));
+  RECORD_I32("load_i32_8x", via);
+  RECORD_I32("add_i32", via + vib);
+  RECORD_I32("mul_i32", via*ib[0]);
+  RECORD_I32("and_i32", via & vib);
+  RECORD_I32("or_i32", via | vib);
+  RECORD_I32("and_u32", via & (u32)ib[0]);
+  RECORD_I32("or_u32", via | (u32)ib[0]);
+  RECORD_I32("shl_i32", via << 5);
+  RECORD_I32("shr_i32", via >> 3);
+  RECORD_I32("mask_load_i32_8x", mask_load_i32_8x(ia, mask));
+  RECORD_I32("gather_i32", gather_i32(table, offsets, mask));
+
+  alignas(32) i32 stored[8];
+  for (u32 i = 0; i < 8; i++) stored[i] = 0x5A5A;
+  mask_store_i32_8x(stored, mask, via);
+  RECORD_I32("mask_store_i32_8x", load_i32_8x(stored));
+
+  RECORD_V2("set8_v2", set8(V2{a[0], b[0]}), 0);
+  RECORD_V2("add_v2", vab + vcb, 0);
+  RECORD_V2("sub_v2", vab - vcb, 0);
+  RECORD_V2("mul_v2", vab*vcb, 0);
+  RECORD_V2("div_v2", 7.0f/vcb, 0);
+  RECORD_V2("perp", perp(vab), 0);
+  RECORD_V2("floor_v2", floor(vab), 0);
+  RECORD_V2("fract", fract(vab), 0);
+  RECORD_V2("clamp01", clamp01(vuv), 0);
+  RECORD_F32("dot", dot(vab, vcb), 1e-2f);
+  RECORD_F32("cross", cross(vab, vcb), 1e-2f);
+  RECORD_I32("inside_unit_square_mask", inside_unit_square_mask(vuv));
+  V2i_8x rounded = v2i_8x(vab);
+  RECORD_I32("v2i_8x.x", rounded.x);
+  RECORD_I32("v2i_8x.y", rounded.y);
+
+  // diagonal kept away from the off-diagonal product so det stays >= ~100
+  Mat2 m = {c[0] + 100, a[1], a[2], c[3] + 100};
+  Mat2_8x vm = set8(m);
+  Mat2_8x cols = mat2_8x_cols(V2_8x{vc + 100.0f, va}, V2_8x{vb, vc + 100.0f});
+  RECORD_MAT2("set8_mat2", vm, 0);
+  RECORD_MAT2("mat2_8x_cols", cols, 0);
+  RECORD_MAT2("mat2_scale", cols*vc, 0);
+  RECORD_MAT2("scale_mat2", vc*vm, 0);
+  RECORD_V2("mat2_mul_v2", vm*vab, 1e-2f);
+  RECORD_V2("v2_mul_mat2", vab*cols, 1e-2f);
+  RECORD_F32("det", det(cols), 1e-2f);
+  RECORD_MAT2("inverse", inverse(cols), 1e-4f);
+
+  // 13 elements: one full block plus a tail of 5 through the padded path
+  f32 x[16], y[16], w[16], h[16], angle[16];
+  for (u32 i = 0; i < 16; i++) {
+    x[i] = simd_random_f32(conf, -128, 256);
+    y[i] = simd_random_f32(conf, -128, 256);
+    w[i] = simd_random_f32(conf, 0.5f, 64);
+    h[i] = simd_random_f32(conf, 0.5f, 64);
+    angle[i] = simd_random_f32(conf, -8, 16);
+  }
+  u32 count = 13;
+  V2_SoA center = {x, y};
+  V2_SoA size = {w, h};
+  RECORD_F32("load8_count", load8(x + 8, count - 8), 0);
+  RECORD_V2("load8_soa", load8(center, 8, count), 0);
+
+  f32 tail[16];
+  f32 tail_x[16];
+  f32 tail_y[16];
+  for (u32 i = 0; i < 16; i++) tail[i] = tail_x[i] = tail_y[i] = -1234.5f;
+  store8(tail + 8, va, count - 8);
+  store8(V2_SoA{tail_x, tail_y}, 8, count, vab);
+  RECORD_F32("store8_count", load8(tail + 8), 0);
+  RECORD_V2("store8_soa", (V2_8x{load8(tail_x + 8), load8(tail_y + 8)}), 0);
+
+  f32 out[8][16];
+  for (u32 i = 0; i < 8; i++) {
+    for (u32 j = 0; j < 16; j++) out[i][j] = -1234.5f;
+  }
+  rotate_rects(center, size, angle, V2_SoA{out[0], out[1]}, V2_SoA{out[2], out[3]},
+               V2_SoA{out[4], out[5]}, count);
+  for (u32 i = 0; i < 6; i++) {
+    RECORD_F32("rotate_rects", load8(out[i]), 1e-2f);
+    RECORD_F32("rotate_rects tail", load8(out[i] + 8), 1e-2f);
+  }
+
+  // fed from the inputs rather than rotate_rects so it stays bit for bit
+  for (u32 i = 0; i < 8; i++) {
+    for (u32 j = 0; j < 16; j++) out[i][j] = -1234.5f;
+  }
+  get_bounds(center, size, V2_SoA{angle, x}, Rect2_SoA{out[0], out[1], out[2], out[3]}, count);
+  for (u32 i = 0; i < 4; i++) {
+    RECORD_F32("get_bounds", load8(out[i]), 0);
+    RECORD_F32("get_bounds tail", load8(out[i] + 8), 0);
+  }
+#undef RECORD_F32
+#undef RECORD_I32
+#undef RECORD_V2
+#undef RECORD_MAT2
+}
+
+void win32_simd_conformance() {
+#if defined(LVL5_SIMD_AVX2)
+  const char *backend = "avx2";
+#elif defined(LVL5_SIMD_SSE)
+  const char *backend = "sse";
+#elif defined(LVL5_SIMD_NEON)
+  const char *backend = "neon";
+#else
+  const char *backend = "scalar";
+#endif
+  Simd_Conformance conf = {
+    .lane_capacity = SIMD_CONFORMANCE_ROUNDS*1024,
+    .random_state = 0x9E3779B9,
+  };
+  conf.lanes = (u32 *)memalloc(sizeof(u32)*conf.lane_capacity);
+
+  char buffer[256];
+#if !defined(LVL5_SIMD_SCALAR)
+  FILE *file;
+  if (fopen_s(&file, SIMD_CONFORMANCE_FILE, "rb") != 0) {
+    sprintf_s(buffer, array_count(buffer), "simd conformance: no %s, run the scalar build first\n",
+              SIMD_CONFORMANCE_FILE);
+    OutputDebugStringA(buffer);
+    memfree(conf.lanes);
+    return;
+  }
+  fread(&conf.reference_count, sizeof(u32), 1, file);
+  conf.reference_count = min(conf.reference_count, conf.lane_capacity);
+  conf.reference = (u32 *)memalloc(sizeof(u32)*conf.lane_capacity);
+  conf.reference_count = (u32)fread(conf.reference, sizeof(u32), conf.reference_count, file);
+  fclose(file);
+#endif
+
+  for (conf.round = 0; conf.round < SIMD_CONFORMANCE_ROUNDS; conf.round++) {
+    simd_conformance_round(&conf);
+  }
+
+#if defined(LVL5_SIMD_SCALAR)
+  FILE *file;
+  fopen_s(&file, SIMD_CONFORMANCE_FILE, "wb");
+  fwrite(&conf.lane_count, sizeof(u32), 1, file);
+  fwrite(conf.lanes, sizeof(u32), conf.lane_count, file);
+  fclose(file);
+  sprintf_s(buffer, array_count(buffer), "simd conformance: scalar backend, recorded %u lanes to %s\n",
+            (unsigned)conf.lane_count, SIMD_CONFORMANCE_FILE);
+#else
+  // a reference from an older build with a different op list
+  if (conf.reference_count != conf.lane_count) conf.mismatch_count++;
+  sprintf_s(buffer, array_count(buffer), "simd conformance: %s backend, %u of %u lanes mismatched against %u recorded\n",
+            backend, (unsigned)conf.mismatch_count, (unsigned)conf.lane_count, (unsigned)conf.reference_count);
+  memfree(conf.reference);
+#endif
+  OutputDebugStringA(buffer);
+  memfree(conf.lanes);
+  assert(conf.mismatch_count == 0);
+}
+#endif
+
 int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR command_line, int show_command_line) {
   init_default_context();
+#ifdef LVL5_TRACK_ALLOCATIONS
+  Alloc_Tracker tracker = make_alloc_tracker();
+  Context_Scope tracker_scope = push_context(&tracker);
+#endif
 
   Font font = os_load_font("ubuntu_mono.ttf", "Ubuntu Mono", 32);
   font.atlas.bmp = win32_read_bmp("foo.bmp");
   // win32_save_bmp("foo2.bmp", font.atlas.bmp);
 
-  u32 logical_core_count = 5;
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  u32 logical_core_count = max((u32)system_info.dwNumberOfProcessors, (u32)2);
 
   Thread *threads = (Thread *)memalloc(sizeof(Thread)*logical_core_count);
   Thread_Queue thread_queue = {
@@ -563,6 +1166,17 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR command_l
   assert(timeBeginPeriod(1) == TIMERR_NOERROR);
   assert(QueryPerformanceFrequency(&performance_frequency));
 
+#ifdef NETLIST_BENCHMARK
+  win32_netlist_benchmark(&thread_queue, logical_core_count);
+  win32_netlist_io_benchmark();
+#endif
+#ifdef LVL5_CONTAINER_BENCHMARK
+  win32_container_benchmark();
+#endif
+#ifdef LVL5_SIMD_CONFORMANCE
+  win32_simd_conformance();
+#endif
+
   char *class_name = "window_class_name";
   WNDCLASSA window_class = {
     .style = CS_HREDRAW|CS_VREDRAW|CS_OWNDC,
@@ -599,7 +1213,10 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR command_l
 
 
   while (running) { 
-    scratch_reset();
+#ifdef LVL5_TRACK_ALLOCATIONS
+    alloc_tracker_end_frame(&tracker, get_context()->scratch);
+#endif
+    begin_frame();
 
     MSG message;
 
@@ -672,5 +1289,8 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE prev_instance, PWSTR command_l
     prev_time = win32_get_time();
   }
 
+#ifdef LVL5_TRACK_ALLOCATIONS
+  alloc_tracker_report(&tracker);
+#endif
   return 0;
 }
@@ -0,0 +1,1315 @@
+// Flat, levelized netlist of primitive gates compiled from a Gate hierarchy.
+//
+// Signals are bytes in a values array:
+//   [0] constant 0, [1] constant 1,
+//   [NET_FIRST_INPUT, NET_FIRST_INPUT + input_count) primary inputs,
+//   then state_count state signals (flip-flop outputs),
+//   then one signal per node, in level order.
+// Every node computes (in0 & in1) ^ op, a NOT is an AND with constant 1
+// and op set, so evaluation is a single branch-free loop.
+// Inputs and states are the sources of the combinational logic, a clock
+// edge copies every state_next signal into its state signal.
+
+enum Net_Op : u8 {
+  NET_AND = 0,
+  NET_NOT = 1,
+};
+
+#define NET_CONST_0 0
+#define NET_CONST_1 1
+#define NET_FIRST_INPUT 2
+
+struct Netlist {
+  u32 input_count;
+  u32 state_count;
+  u32 node_count;
+  u8 *ops;
+  u32 *in0;
+  u32 *in1;
+
+  // nodes of level l are [level_offsets[l], level_offsets[l + 1])
+  u32 level_count;
+  u32 *level_offsets;
+
+  u32 output_count;
+  u32 *outputs;
+
+  // state s takes the value of signal state_next[s] on a clock edge
+  u32 *state_next;
+
+  // nodes reading signal s are fanouts[fanout_offsets[s]..fanout_offsets[s + 1]]
+  u32 *fanout_offsets;
+  u32 *fanouts;
+  u32 *node_levels;
+};
+
+u32 netlist_first_state_signal(Netlist *net) {
+  u32 result = NET_FIRST_INPUT + net->input_count;
+  return result;
+}
+
+u32 netlist_first_node_signal(Netlist *net) {
+  u32 result = netlist_first_state_signal(net) + net->state_count;
+  return result;
+}
+
+u32 netlist_signal_count(Netlist *net) {
+  u32 result = netlist_first_node_signal(net) + net->node_count;
+  return result;
+}
+
+void netlist_free(Netlist *net) {
+  if (net->ops) memfree(net->ops);
+  if (net->in0) memfree(net->in0);
+  if (net->in1) memfree(net->in1);
+  if (net->level_offsets) memfree(net->level_offsets);
+  if (net->outputs) memfree(net->outputs);
+  if (net->state_next) memfree(net->state_next);
+  if (net->fanout_offsets) memfree(net->fanout_offsets);
+  if (net->fanouts) memfree(net->fanouts);
+  if (net->node_levels) memfree(net->node_levels);
+  *net = {};
+}
+
+// builds fanout_offsets, fanouts and node_levels from the levelized nodes
+void netlist_build_fanouts(Netlist *net) {
+  u32 signal_count = netlist_signal_count(net);
+  u32 *offsets = (u32 *)memalloc(sizeof(u32)*(signal_count + 1));
+  memset(offsets, 0, sizeof(u32)*(signal_count + 1));
+  u32 edge_count = 0;
+  for (u32 n = 0; n < net->node_count; n++) {
+    offsets[net->in0[n] + 1]++;
+    edge_count++;
+    if (net->in1[n] != net->in0[n]) {
+      offsets[net->in1[n] + 1]++;
+      edge_count++;
+    }
+  }
+  for (u32 i = 0; i < signal_count; i++) offsets[i + 1] += offsets[i];
+
+  // scatter with offsets[s] as the cursor, then shift the cursors back
+  u32 *fanouts = (u32 *)memalloc(sizeof(u32)*(edge_count + 1));
+  for (u32 n = 0; n < net->node_count; n++) {
+    fanouts[offsets[net->in0[n]]++] = n;
+    if (net->in1[n] != net->in0[n]) fanouts[offsets[net->in1[n]]++] = n;
+  }
+  for (u32 i = signal_count; i > 0; i--) offsets[i] = offsets[i - 1];
+  offsets[0] = 0;
+
+  u32 *node_levels = (u32 *)memalloc(sizeof(u32)*(net->node_count + 1));
+  for (u32 l = 0; l < net->level_count; l++) {
+    for (u32 n = net->level_offsets[l]; n < net->level_offsets[l + 1]; n++) node_levels[n] = l;
+  }
+
+  net->fanout_offsets = offsets;
+  net->fanouts = fanouts;
+  net->node_levels = node_levels;
+}
+
+// values must hold netlist_signal_count entries with the inputs already set
+void netlist_eval(Netlist *net, u8 *values) {
+  values[NET_CONST_0] = 0;
+  values[NET_CONST_1] = 1;
+
+  u8 *ops = net->ops;
+  u32 *in0 = net->in0;
+  u32 *in1 = net->in1;
+  u8 *node_values = values + netlist_first_node_signal(net);
+  for (u32 i = 0; i < net->node_count; i++) {
+    node_values[i] = (u8)((values[in0[i]] & values[in1[i]]) ^ ops[i]);
+  }
+}
+
+// NOTE: bit-sliced evaluation. Every signal is a word and lane k of every
+// word belongs to the k-th independent input vector, so one pass over the
+// netlist simulates 64 (u64) or 256 (Lanes_256) vectors.
+struct Lanes_256 {
+  u64 e[4];
+};
+
+Lanes_256 operator&(Lanes_256 a, Lanes_256 b) {
+  Lanes_256 result;
+  for (u32 i = 0; i < 4; i++) result.e[i] = a.e[i] & b.e[i];
+  return result;
+}
+
+Lanes_256 operator^(Lanes_256 a, Lanes_256 b) {
+  Lanes_256 result;
+  for (u32 i = 0; i < 4; i++) result.e[i] = a.e[i] ^ b.e[i];
+  return result;
+}
+
+void fill_lanes(u8 *word, bool bit) {
+  *word = bit;
+}
+
+void fill_lanes(u64 *word, bool bit) {
+  *word = 0 - (u64)bit;
+}
+
+void fill_lanes(Lanes_256 *word, bool bit) {
+  for (u32 i = 0; i < 4; i++) word->e[i] = 0 - (u64)bit;
+}
+
+bool get_lane(u64 word, u32 lane) {
+  bool result = (word >> lane) & 1;
+  return result;
+}
+
+bool get_lane(Lanes_256 word, u32 lane) {
+  bool result = (word.e[lane/64] >> (lane % 64)) & 1;
+  return result;
+}
+
+void set_lane(u64 *word, u32 lane, bool bit) {
+  *word = (*word & ~((u64)1 << lane)) | ((u64)bit << lane);
+}
+
+void set_lane(Lanes_256 *word, u32 lane, bool bit) {
+  set_lane(word->e + lane/64, lane % 64, bit);
+}
+
+// values must hold netlist_signal_count words with the input words already set
+template<typename W>
+void netlist_eval_lanes(Netlist *net, W *values) {
+  W invert[2];
+  fill_lanes(invert + 0, false);
+  fill_lanes(invert + 1, true);
+  values[NET_CONST_0] = invert[0];
+  values[NET_CONST_1] = invert[1];
+
+  u8 *ops = net->ops;
+  u32 *in0 = net->in0;
+  u32 *in1 = net->in1;
+  W *node_values = values + netlist_first_node_signal(net);
+  for (u32 i = 0; i < net->node_count; i++) {
+    node_values[i] = (values[in0[i]] & values[in1[i]]) ^ invert[ops[i]];
+  }
+}
+
+template<typename W>
+void netlist_set_input_lanes(Netlist *net, W *values, u32 in_index, W lanes) {
+  assert(in_index < net->input_count);
+  values[NET_FIRST_INPUT + in_index] = lanes;
+}
+
+template<typename W>
+W netlist_get_output_lanes(Netlist *net, W *values, u32 out_index) {
+  assert(out_index < net->output_count);
+  W result = values[net->outputs[out_index]];
+  return result;
+}
+
+// Levels are split into ranges of at least NETLIST_TASK_MIN_NODES nodes,
+// a level's nodes only read lower levels so its ranges run concurrently.
+#define NETLIST_MAX_TASKS 32
+#define NETLIST_TASK_MIN_NODES 2048
+
+template<typename W>
+struct Netlist_Eval_Task {
+  Netlist *net;
+  W *values;
+  u32 first_node;
+  u32 last_node;
+};
+
+template<typename W>
+void do_netlist_eval_task(Netlist_Eval_Task<W> *task) {
+  Netlist *net = task->net;
+  W *values = task->values;
+  W invert[2] = {values[NET_CONST_0], values[NET_CONST_1]};
+
+  u8 *ops = net->ops;
+  u32 *in0 = net->in0;
+  u32 *in1 = net->in1;
+  W *node_values = values + netlist_first_node_signal(net);
+  for (u32 i = task->first_node; i < task->last_node; i++) {
+    node_values[i] = (values[in0[i]] & values[in1[i]]) ^ invert[ops[i]];
+  }
+}
+
+// Same result as netlist_eval_lanes, with at most task_count tasks per level.
+template<typename W>
+void netlist_eval_lanes_threaded(Thread_Queue *queue, u32 task_count, Netlist *net, W *values) {
+  fill_lanes(values + NET_CONST_0, false);
+  fill_lanes(values + NET_CONST_1, true);
+  task_count = max(min(task_count, (u32)NETLIST_MAX_TASKS), (u32)1);
+
+  Netlist_Eval_Task<W> tasks[NETLIST_MAX_TASKS];
+  for (u32 level = 0; level < net->level_count; level++) {
+    u32 first = net->level_offsets[level];
+    u32 node_count = net->level_offsets[level + 1] - first;
+    u32 level_task_count = min(task_count, node_count/NETLIST_TASK_MIN_NODES);
+
+    if (level_task_count <= 1) {
+      Netlist_Eval_Task<W> task = {net, values, first, first + node_count};
+      do_netlist_eval_task(&task);
+    } else {
+      u32 task_nodes = node_count/level_task_count;
+      for (u32 task_index = 0; task_index < level_task_count; task_index++) {
+        tasks[task_index] = {
+          .net = net,
+          .values = values,
+          .first_node = first + task_index*task_nodes,
+          .last_node = task_index == level_task_count - 1 ? first + node_count
+                                                          : first + (task_index + 1)*task_nodes,
+        };
+        add_thread_task(queue, (Worker_Fn)do_netlist_eval_task<W>, tasks + task_index);
+      }
+      wait_for_all_tasks(queue);
+    }
+  }
+}
+
+// Runs cycle_count clock edges, values must be evaluated on entry and are
+// evaluated on return. All next states are gathered into next_state
+// (state_count words) before any is committed, so chained flip-flops
+// shift by exactly one stage per cycle.
+template<typename W>
+void netlist_step_lanes(Netlist *net, W *values, W *next_state, u32 cycle_count) {
+  W *state = values + netlist_first_state_signal(net);
+  u32 *state_next = net->state_next;
+  for (u32 cycle = 0; cycle < cycle_count; cycle++) {
+    for (u32 i = 0; i < net->state_count; i++) next_state[i] = values[state_next[i]];
+    for (u32 i = 0; i < net->state_count; i++) state[i] = next_state[i];
+    netlist_eval_lanes(net, values);
+  }
+}
+
+// Exhaustive simulation of every input assignment, 256 per pass.
+// Bit i of an output's table is its value for the assignment whose bit k
+// is input k, with every state at 0; each output gets
+// netlist_truth_table_words entries.
+u64 netlist_truth_table_words(Netlist *net) {
+  assert(net->input_count < 64);
+  u64 assignment_count = (u64)1 << net->input_count;
+  u64 result = (assignment_count + 63)/64;
+  return result;
+}
+
+void netlist_truth_table(Netlist *net, u64 *result) {
+  // lane patterns of the low 8 inputs within one 256-lane pass
+  u64 low_patterns[6] = {
+    0xAAAAAAAAAAAAAAAA, 0xCCCCCCCCCCCCCCCC, 0xF0F0F0F0F0F0F0F0,
+    0xFF00FF00FF00FF00, 0xFFFF0000FFFF0000, 0xFFFFFFFF00000000,
+  };
+
+  u64 words_per_output = netlist_truth_table_words(net);
+  u64 assignment_count = (u64)1 << net->input_count;
+  Lanes_256 *values = (Lanes_256 *)memalloc(sizeof(Lanes_256)*netlist_signal_count(net));
+
+  for (u64 batch = 0; batch*256 < assignment_count; batch++) {
+    for (u32 in = 0; in < net->input_count; in++) {
+      Lanes_256 lanes;
+      for (u32 i = 0; i < 4; i++) {
+        if (in < 6) {
+          lanes.e[i] = low_patterns[in];
+        } else if (in < 8) {
+          lanes.e[i] = 0 - (u64)((i >> (in - 6)) & 1);
+        } else {
+          lanes.e[i] = 0 - ((batch >> (in - 8)) & 1);
+        }
+      }
+      netlist_set_input_lanes(net, values, in, lanes);
+    }
+
+    for (u32 i = 0; i < net->state_count; i++) {
+      fill_lanes(values + netlist_first_state_signal(net) + i, false);
+    }
+    netlist_eval_lanes(net, values);
+
+    for (u32 out = 0; out < net->output_count; out++) {
+      Lanes_256 lanes = netlist_get_output_lanes(net, values, out);
+      for (u64 i = 0; i < 4 && batch*4 + i < words_per_output; i++) {
+        u64 word = lanes.e[i];
+        if (assignment_count < 64) word &= ((u64)1 << assignment_count) - 1;
+        result[out*words_per_output + batch*4 + i] = word;
+      }
+    }
+  }
+
+  memfree(values);
+}
+
+// Random levelized netlist for benchmarks: level_count levels of equal
+// width, every node reads one signal of the previous level (or an input)
+// and one random earlier signal.
+void netlist_generate(Netlist *net, u32 input_count, u32 node_count, u32 level_count, u32 seed) {
+  assert(input_count && level_count && node_count >= level_count);
+  *net = {
+    .input_count = input_count,
+    .node_count = node_count,
+  };
+  net->ops = (u8 *)memalloc(node_count + 1);
+  net->in0 = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  net->in1 = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  net->level_count = level_count;
+  net->level_offsets = (u32 *)memalloc(sizeof(u32)*(level_count + 1));
+
+  u32 rng = seed | 1;
+#define NEXT_RANDOM() (rng ^= rng << 13, rng ^= rng >> 17, rng ^= rng << 5)
+
+  u32 first_node = netlist_first_node_signal(net);
+  u32 prev_first = NET_FIRST_INPUT;
+  u32 prev_count = input_count;
+  for (u32 level = 0; level < level_count; level++) {
+    u32 first = (u32)((u64)node_count*level/level_count);
+    u32 last = (u32)((u64)node_count*(level + 1)/level_count);
+    net->level_offsets[level] = first;
+    for (u32 n = first; n < last; n++) {
+      net->ops[n] = (u8)(NEXT_RANDOM() & 1);
+      net->in0[n] = prev_first + NEXT_RANDOM() % prev_count;
+      net->in1[n] = NET_FIRST_INPUT + NEXT_RANDOM() % (first_node - NET_FIRST_INPUT + first);
+    }
+    prev_first = first_node + first;
+    prev_count = last - first;
+  }
+  net->level_offsets[level_count] = node_count;
+#undef NEXT_RANDOM
+
+  net->output_count = min(node_count, (u32)64);
+  net->outputs = (u32 *)memalloc(sizeof(u32)*(net->output_count + 1));
+  for (u32 out = 0; out < net->output_count; out++) {
+    net->outputs[out] = first_node + node_count - 1 - out;
+  }
+}
+
+// and counts two input nodes (AND and NAND), not counts inverters
+struct Netlist_Optimize_Stats {
+  u32 and_count_before;
+  u32 not_count_before;
+  u32 level_count_before;
+  u32 and_count_after;
+  u32 not_count_after;
+  u32 level_count_after;
+};
+
+void netlist_count_ops(Netlist *net, u32 *and_count, u32 *not_count) {
+  *not_count = 0;
+  for (u32 n = 0; n < net->node_count; n++) {
+    *not_count += net->ops[n] == NET_NOT && net->in1[n] == NET_CONST_1;
+  }
+  *and_count = net->node_count - *not_count;
+}
+
+// Rewrites the netlist as an and-inverter graph: a literal is
+// signal*2 + inverted, NOTs only flip literals, so NOT pairs cancel.
+// ANDs with constant or equal/opposite operands fold away and identical
+// ANDs are hashed into one. Only ANDs reachable from the outputs, the
+// next states and keep_signals survive, those are then written back as
+// AND/NAND nodes plus a NOT per inverted input or state.
+// keep_signals are translated to the new signals in place.
+void netlist_optimize(Netlist *net, u32 *keep_signals, u32 keep_count, Netlist_Optimize_Stats *stats) {
+#define LIT(signal, inverted) (((signal) << 1) | (inverted))
+#define LIT_FALSE LIT(NET_CONST_0, 0)
+#define LIT_TRUE LIT(NET_CONST_0, 1)
+  *stats = {};
+  netlist_count_ops(net, &stats->and_count_before, &stats->not_count_before);
+  stats->level_count_before = net->level_count;
+
+  u32 first_node = netlist_first_node_signal(net);
+  u32 signal_count = netlist_signal_count(net);
+  u32 *lits = (u32 *)memalloc(sizeof(u32)*(signal_count + 1));
+  for (u32 s = 0; s < first_node; s++) lits[s] = LIT(s, 0);
+  lits[NET_CONST_1] = LIT_TRUE;
+
+  // hashed ANDs, AND a has signal first_node + a and operands ands[2*a..]
+  u32 *ands = (u32 *)memalloc(sizeof(u32)*2*(net->node_count + 1));
+  u32 and_count = 0;
+  u32 table_size = 16;
+  while (table_size < net->node_count*2) table_size *= 2;
+  u32 *table = (u32 *)memalloc(sizeof(u32)*table_size);
+  memset(table, 0xFF, sizeof(u32)*table_size);
+
+  for (u32 n = 0; n < net->node_count; n++) {
+    u32 a = lits[net->in0[n]];
+    u32 b = lits[net->in1[n]];
+    if (a > b) {
+      u32 temp = a;
+      a = b;
+      b = temp;
+    }
+
+    u32 lit;
+    if (a == LIT_FALSE || (a ^ 1) == b) {
+      lit = LIT_FALSE;
+    } else if (a == LIT_TRUE || a == b) {
+      lit = b;
+    } else {
+      u32 slot = (u32)(((u64)a*0x9E3779B1 ^ (u64)b*0x85EBCA77) & (table_size - 1));
+      while (table[slot] != 0xFFFFFFFF && (ands[table[slot]*2] != a || ands[table[slot]*2 + 1] != b)) {
+        slot = (slot + 1) & (table_size - 1);
+      }
+      if (table[slot] == 0xFFFFFFFF) {
+        table[slot] = and_count;
+        ands[and_count*2] = a;
+        ands[and_count*2 + 1] = b;
+        and_count++;
+      }
+      lit = LIT(first_node + table[slot], 0);
+    }
+    lits[first_node + n] = lit ^ net->ops[n];
+  }
+
+  // mark the literals something reads, from the roots back
+  u32 lit_count = 2*(first_node + and_count);
+  u8 *needed = (u8 *)memalloc(lit_count + 1);
+  memset(needed, 0, lit_count + 1);
+  for (u32 i = 0; i < net->output_count; i++) needed[lits[net->outputs[i]]] = true;
+  for (u32 i = 0; i < net->state_count; i++) needed[lits[net->state_next[i]]] = true;
+  for (u32 i = 0; i < keep_count; i++) needed[lits[keep_signals[i]]] = true;
+  for (u32 a = and_count; a > 0; a--) {
+    u32 signal = first_node + a - 1;
+    if (needed[LIT(signal, 0)] || needed[LIT(signal, 1)]) {
+      needed[ands[(a - 1)*2]] = true;
+      needed[ands[(a - 1)*2 + 1]] = true;
+    }
+  }
+
+  // one node per needed inverted source and per needed AND polarity,
+  // created in topological order; provisional signals as in circuit_compile
+  u32 node_tag = 0x80000000;
+  u32 *lit_signals = (u32 *)memalloc(sizeof(u32)*(lit_count + 1));
+  u32 max_nodes = lit_count;
+  u8 *ops = (u8 *)memalloc(max_nodes + 1);
+  u32 *in0 = (u32 *)memalloc(sizeof(u32)*(max_nodes + 1));
+  u32 *in1 = (u32 *)memalloc(sizeof(u32)*(max_nodes + 1));
+  u32 *levels = (u32 *)memalloc(sizeof(u32)*(max_nodes + 1));
+  u32 node_count = 0;
+  u32 level_count = 0;
+#define NODE_LEVEL(s) ((s) >= node_tag ? levels[(s) - node_tag] + 1 : 0)
+#define ADD_NODE(op, a, b) (ops[node_count] = (op), in0[node_count] = (a), in1[node_count] = (b), \
+                            levels[node_count] = max(NODE_LEVEL(a), NODE_LEVEL(b)), \
+                            level_count = max(level_count, levels[node_count] + 1), node_tag + node_count++)
+
+  lit_signals[LIT_FALSE] = NET_CONST_0;
+  lit_signals[LIT_TRUE] = NET_CONST_1;
+  for (u32 s = NET_FIRST_INPUT; s < first_node; s++) {
+    lit_signals[LIT(s, 0)] = s;
+    if (needed[LIT(s, 1)]) lit_signals[LIT(s, 1)] = ADD_NODE(NET_NOT, s, NET_CONST_1);
+  }
+  for (u32 a = 0; a < and_count; a++) {
+    u32 signal = first_node + a;
+    for (u32 inverted = 0; inverted < 2; inverted++) {
+      if (needed[LIT(signal, inverted)]) {
+        lit_signals[LIT(signal, inverted)] = ADD_NODE(inverted ? NET_NOT : NET_AND,
+                                                      lit_signals[ands[a*2]], lit_signals[ands[a*2 + 1]]);
+      }
+    }
+  }
+#undef ADD_NODE
+#undef NODE_LEVEL
+
+  // counting sort by level, the same as circuit_compile
+  u32 *level_offsets = (u32 *)memalloc(sizeof(u32)*(level_count + 1));
+  memset(level_offsets, 0, sizeof(u32)*(level_count + 1));
+  for (u32 n = 0; n < node_count; n++) level_offsets[levels[n] + 1]++;
+  for (u32 l = 0; l < level_count; l++) level_offsets[l + 1] += level_offsets[l];
+  u32 *cursors = (u32 *)memalloc(sizeof(u32)*(level_count + 1));
+  memcpy(cursors, level_offsets, sizeof(u32)*(level_count + 1));
+  u32 *new_index = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  for (u32 n = 0; n < node_count; n++) new_index[n] = cursors[levels[n]]++;
+
+#define FINAL_SIGNAL(s) ((s) >= node_tag ? first_node + new_index[(s) - node_tag] : (s))
+  u8 *final_ops = (u8 *)memalloc(node_count + 1);
+  u32 *final_in0 = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  u32 *final_in1 = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  for (u32 n = 0; n < node_count; n++) {
+    final_ops[new_index[n]] = ops[n];
+    final_in0[new_index[n]] = FINAL_SIGNAL(in0[n]);
+    final_in1[new_index[n]] = FINAL_SIGNAL(in1[n]);
+  }
+  for (u32 i = 0; i < net->output_count; i++) {
+    net->outputs[i] = FINAL_SIGNAL(lit_signals[lits[net->outputs[i]]]);
+  }
+  for (u32 i = 0; i < net->state_count; i++) {
+    net->state_next[i] = FINAL_SIGNAL(lit_signals[lits[net->state_next[i]]]);
+  }
+  for (u32 i = 0; i < keep_count; i++) {
+    keep_signals[i] = FINAL_SIGNAL(lit_signals[lits[keep_signals[i]]]);
+  }
+#undef FINAL_SIGNAL
+
+  bool had_fanouts = net->fanout_offsets != nullptr;
+  memfree(net->ops);
+  memfree(net->in0);
+  memfree(net->in1);
+  memfree(net->level_offsets);
+  if (net->fanout_offsets) memfree(net->fanout_offsets);
+  if (net->fanouts) memfree(net->fanouts);
+  if (net->node_levels) memfree(net->node_levels);
+  net->node_count = node_count;
+  net->ops = final_ops;
+  net->in0 = final_in0;
+  net->in1 = final_in1;
+  net->level_count = level_count;
+  net->level_offsets = level_offsets;
+  net->fanout_offsets = nullptr;
+  net->fanouts = nullptr;
+  net->node_levels = nullptr;
+  if (had_fanouts) netlist_build_fanouts(net);
+
+  netlist_count_ops(net, &stats->and_count_after, &stats->not_count_after);
+  stats->level_count_after = net->level_count;
+
+  memfree(lits);
+  memfree(ands);
+  memfree(table);
+  memfree(needed);
+  memfree(lit_signals);
+  memfree(ops);
+  memfree(in0);
+  memfree(in1);
+  memfree(levels);
+  memfree(cursors);
+  memfree(new_index);
+#undef LIT_TRUE
+#undef LIT_FALSE
+#undef LIT
+}
+
+// Per-gate fan-out and fan-in wire lists, wires by index into the array
+// the index was built from. Every gate owns a segment of the list array
+// with room to spare, so connect and disconnect patch the index in place:
+// an add that doesn't fit moves the gate's segment to the end with twice
+// the room, a remove swaps the last wire of the segment into the hole.
+// Anything else (destroying gates, loading, a wire array that moved
+// under it) leaves the index stale, and it is rebuilt in one linear pass
+// the first time it is queried. That rebuild also drops the holes moved
+// segments leave behind, patches give up once those outgrow the wires.
+struct Wire_Lists {
+  // gate g's wires are wires[starts[g]..starts[g] + counts[g]]
+  Array<u32> starts;
+  Array<u32> counts;
+  Array<u32> capacities;
+  Array<u32> wires;
+};
+
+struct Wire_Index {
+  Wire *wires;
+  u32 gate_count;
+  u32 wire_count;
+  // of the wire array, tells edits apart that keep the counts
+  u32 version;
+
+  Wire_Lists fanout;
+  Wire_Lists fanin;
+};
+
+struct Wire_List {
+  u32 *indices;
+  u32 count;
+};
+
+void wire_lists_free(Wire_Lists *lists) {
+  array_free(&lists->starts);
+  array_free(&lists->counts);
+  array_free(&lists->capacities);
+  array_free(&lists->wires);
+}
+
+void wire_index_free(Wire_Index *index) {
+  wire_lists_free(&index->fanout);
+  wire_lists_free(&index->fanin);
+  *index = {};
+}
+
+// counting sort of the wires by gate, segments without spare room
+void wire_lists_build(Wire_Lists *lists, u32 gate_count, Wire *wires, u32 wire_count, bool by_start) {
+  array_reserve(&lists->starts, gate_count);
+  array_reserve(&lists->counts, gate_count);
+  array_reserve(&lists->capacities, gate_count);
+  array_reserve(&lists->wires, wire_count);
+  lists->starts.count = gate_count;
+  lists->counts.count = gate_count;
+  lists->capacities.count = gate_count;
+  lists->wires.count = wire_count;
+
+  u32 *starts = lists->starts.data;
+  u32 *counts = lists->counts.data;
+  memset(counts, 0, sizeof(u32)*gate_count);
+  for (u32 w = 0; w < wire_count; w++) {
+    Gate_Id gate = by_start ? wires[w].start : wires[w].end;
+    counts[gate]++;
+  }
+  u32 offset = 0;
+  for (u32 g = 0; g < gate_count; g++) {
+    starts[g] = offset;
+    offset += counts[g];
+  }
+  memcpy(lists->capacities.data, counts, sizeof(u32)*gate_count);
+  // scatter with counts as the cursors, they end up where they started
+  memset(counts, 0, sizeof(u32)*gate_count);
+  for (u32 w = 0; w < wire_count; w++) {
+    Gate_Id gate = by_start ? wires[w].start : wires[w].end;
+    lists->wires[starts[gate] + counts[gate]++] = w;
+  }
+}
+
+// new gates start out with empty segments
+void wire_lists_add_gates(Wire_Lists *lists, u32 gate_count) {
+  while (lists->starts.count < gate_count) {
+    array_push(&lists->starts, (u32)0);
+    array_push(&lists->counts, (u32)0);
+    array_push(&lists->capacities, (u32)0);
+  }
+}
+
+void wire_lists_add(Wire_Lists *lists, Gate_Id gate, u32 wire) {
+  u32 count = lists->counts[gate];
+  if (count == lists->capacities[gate]) {
+    u32 capacity = count ? count*2 : 4;
+    u32 start = lists->wires.count;
+    array_grow_for(&lists->wires, capacity);
+    lists->wires.count += capacity;
+    memcpy(lists->wires.data + start, lists->wires.data + lists->starts[gate], sizeof(u32)*count);
+    lists->starts[gate] = start;
+    lists->capacities[gate] = capacity;
+  }
+  lists->wires[lists->starts[gate] + lists->counts[gate]++] = wire;
+}
+
+// replaces wire with last_wire in gate's segment, or drops it when it was the last
+void wire_lists_remove(Wire_Lists *lists, Gate_Id gate, u32 wire) {
+  u32 *segment = lists->wires.data + lists->starts[gate];
+  u32 count = lists->counts[gate];
+  for (u32 i = 0; i < count; i++) {
+    if (segment[i] == wire) {
+      segment[i] = segment[count - 1];
+      lists->counts[gate] = count - 1;
+      break;
+    }
+  }
+}
+
+void wire_lists_rename(Wire_Lists *lists, Gate_Id gate, u32 from, u32 to) {
+  u32 *segment = lists->wires.data + lists->starts[gate];
+  for (u32 i = 0; i < lists->counts[gate]; i++) {
+    if (segment[i] == from) segment[i] = to;
+  }
+}
+
+// true when at most gates were added since the index was last brought up to date
+bool wire_index_is_current(Wire_Index *index, u32 gate_count, Wire *wires, u32 wire_count, u32 version) {
+  bool result = index->wires == wires && index->version == version &&
+                index->wire_count == wire_count && index->gate_count <= gate_count;
+  return result;
+}
+
+void wire_index_update(Wire_Index *index, u32 gate_count, Wire *wires, u32 wire_count, u32 version) {
+  if (!wire_index_is_current(index, gate_count, wires, wire_count, version)) {
+    wire_lists_build(&index->fanout, gate_count, wires, wire_count, true);
+    wire_lists_build(&index->fanin, gate_count, wires, wire_count, false);
+  } else if (index->gate_count < gate_count) {
+    wire_lists_add_gates(&index->fanout, gate_count);
+    wire_lists_add_gates(&index->fanin, gate_count);
+  }
+  index->wires = wires;
+  index->version = version;
+  index->gate_count = gate_count;
+  index->wire_count = wire_count;
+}
+
+// After wire_count - 1 was appended to wires. Call only while the index
+// was current before the append, the wire may start or end at new gates.
+void wire_index_add(Wire_Index *index, u32 gate_count, Wire *wires, u32 wire_count, u32 version) {
+  u32 w = wire_count - 1;
+  wire_lists_add_gates(&index->fanout, gate_count);
+  wire_lists_add_gates(&index->fanin, gate_count);
+  wire_lists_add(&index->fanout, wires[w].start, w);
+  wire_lists_add(&index->fanin, wires[w].end, w);
+  index->wires = wires;
+  index->version = version;
+  index->gate_count = gate_count;
+  index->wire_count = wire_count;
+  // room and holes from moved segments outgrew the wires, leave it to a rebuild
+  if (index->fanout.wires.count > 4*wire_count + 64 || index->fanin.wires.count > 4*wire_count + 64) {
+    index->wires = nullptr;
+  }
+}
+
+// After the wire at w was removed and the last one moved into its hole.
+// Call only while the index was current before the removal.
+void wire_index_remove(Wire_Index *index, Wire removed, u32 w, Wire *wires, u32 wire_count, u32 version) {
+  wire_lists_remove(&index->fanout, removed.start, w);
+  wire_lists_remove(&index->fanin, removed.end, w);
+  if (w != wire_count) {
+    wire_lists_rename(&index->fanout, wires[w].start, wire_count, w);
+    wire_lists_rename(&index->fanin, wires[w].end, wire_count, w);
+  }
+  index->wires = wires;
+  index->version = version;
+  index->wire_count = wire_count;
+}
+
+Wire_List wire_index_fanout(Wire_Index *index, Gate_Id g) {
+  assert(g < index->gate_count);
+  Wire_List result = {
+    .indices = index->fanout.wires.data + index->fanout.starts[g],
+    .count = index->fanout.counts[g],
+  };
+  return result;
+}
+
+Wire_List wire_index_fanin(Wire_Index *index, Gate_Id g) {
+  assert(g < index->gate_count);
+  Wire_List result = {
+    .indices = index->fanin.wires.data + index->fanin.starts[g],
+    .count = index->fanin.counts[g],
+  };
+  return result;
+}
+
+// NOTE: path-halving union find over pin indices
+u32 pin_set_find(u32 *parents, u32 pin) {
+  while (parents[pin] != pin) {
+    parents[pin] = parents[parents[pin]];
+    pin = parents[pin];
+  }
+  return pin;
+}
+
+void pin_set_union(u32 *parents, u32 a, u32 b) {
+  a = pin_set_find(parents, a);
+  b = pin_set_find(parents, b);
+  if (a != b) parents[a] = b;
+}
+
+// driver of the pin's net, undriven nets read constant 0
+u32 pin_driver(u32 *drivers, u32 *parents, u32 pin, u32 undriven) {
+  u32 result = drivers[pin_set_find(parents, pin)];
+  if (result == undriven) result = NET_CONST_0;
+  return result;
+}
+
+// root compiled into a Netlist, plus the signal of every pin under it
+struct Circuit {
+  Gate_Store *gates;
+  Gate_Id root;
+  Netlist net;
+  u8 *values;
+  u8 *next_state;
+
+  // incremental updates, the queue of level l lives in that level's
+  // node range: queue[level_offsets[l]..] holds queue_counts[l] nodes
+  u32 *queue;
+  u32 *queue_counts;
+  u8 *queued;
+  u32 first_dirty_level;
+
+  // signal of every pin in the gate store's pin pool at compile time
+  u32 pin_count;
+  u32 *pin_signals;
+};
+
+// loops are only legal through a flip-flop or a latch's state
+enum Circuit_Compile_Result {
+  CIRCUIT_COMPILE_OK,
+  CIRCUIT_COMPILE_COMBINATIONAL_LOOP,
+};
+
+// (re)allocates the simulation buffers for circuit->net, all values 0
+void circuit_alloc_buffers(Circuit *circuit) {
+  Netlist *net = &circuit->net;
+  if (circuit->values) memfree(circuit->values);
+  if (circuit->next_state) memfree(circuit->next_state);
+  if (circuit->queue) memfree(circuit->queue);
+  if (circuit->queue_counts) memfree(circuit->queue_counts);
+  if (circuit->queued) memfree(circuit->queued);
+
+  u32 signal_count = netlist_signal_count(net);
+  circuit->values = (u8 *)memalloc(signal_count);
+  memset(circuit->values, 0, signal_count);
+  netlist_eval(net, circuit->values);
+
+  circuit->next_state = (u8 *)memalloc(net->state_count + 1);
+  circuit->queue = (u32 *)memalloc(sizeof(u32)*(net->node_count + 1));
+  circuit->queue_counts = (u32 *)memalloc(sizeof(u32)*(net->level_count + 1));
+  memset(circuit->queue_counts, 0, sizeof(u32)*(net->level_count + 1));
+  circuit->queued = (u8 *)memalloc(net->node_count + 1);
+  memset(circuit->queued, 0, net->node_count + 1);
+  circuit->first_dirty_level = net->level_count;
+}
+
+void circuit_free(Circuit *circuit) {
+  netlist_free(&circuit->net);
+  if (circuit->values) memfree(circuit->values);
+  if (circuit->next_state) memfree(circuit->next_state);
+  if (circuit->queue) memfree(circuit->queue);
+  if (circuit->queue_counts) memfree(circuit->queue_counts);
+  if (circuit->queued) memfree(circuit->queued);
+  if (circuit->pin_signals) memfree(circuit->pin_signals);
+  *circuit = {};
+}
+
+Netlist *netlist_compile_def(Gate_Store *gates, Wire *wires, u32 wire_count, Gate_Id def);
+
+// Flattens root's hierarchy: composite pins and IN/OUT gates are merged
+// with the wires into nets, each net is driven by an AND/NOT output,
+// a root input or nothing (constant 0). The AND/NOT gates are then
+// levelized with Kahn's algorithm, whatever is left over sits on a loop.
+Circuit_Compile_Result circuit_compile(Gate_Store *gates, Wire *wires, u32 wire_count,
+                                       Gate_Id root, Circuit *result)
+{
+  // an instance root compiles its definition
+  if (gates->defs[root] != GATE_NONE) root = gates->defs[root];
+
+  u32 gate_count = gates->count;
+  u32 pin_count = gates->pin_count;
+  u8 *ops = gates->ops;
+  u32 *in_counts = gates->in_counts;
+  u32 *out_counts = gates->out_counts;
+  u32 *pin_offsets = gates->pin_offsets;
+  Gate_Id *defs = gates->defs;
+
+  Circuit_Compile_Result status = CIRCUIT_COMPILE_OK;
+  *result = {
+    .gates = gates,
+    .root = root,
+    .pin_count = pin_count,
+  };
+#define PIN(g, n) (pin_offsets[g] + (n))
+
+  // gates under root, including root
+  u8 *in_hierarchy = (u8 *)memalloc(gate_count + 1);
+  memset(in_hierarchy, 0, gate_count + 1);
+  u32 *stack = (u32 *)memalloc(sizeof(u32)*(gate_count + 1));
+  u32 stack_count = 0;
+  stack[stack_count++] = root;
+  in_hierarchy[root] = true;
+  while (stack_count) {
+    Gate_Id gate = stack[--stack_count];
+    Gate_Id def = defs[gate];
+    if (def != GATE_NONE) {
+      // a definition that fails to compile is cached as nullptr too,
+      // and leaves its instances empty
+      if (gates->def_netlist_versions[def] != gates->edit_version) {
+        if (gates->def_netlists[def]) {
+          netlist_free(gates->def_netlists[def]);
+          memfree(gates->def_netlists[def]);
+        }
+        gates->def_netlists[def] = netlist_compile_def(gates, wires, wire_count, def);
+        gates->def_netlist_versions[def] = gates->edit_version;
+      }
+      if (!gates->def_netlists[def]) status = CIRCUIT_COMPILE_COMBINATIONAL_LOOP;
+    }
+    for (Gate_Id child = gates->first_children[gate]; child != GATE_NONE; child = gates->next_siblings[child]) {
+      if (!in_hierarchy[child]) {
+        in_hierarchy[child] = true;
+        stack[stack_count++] = child;
+      }
+    }
+  }
+
+  u32 *parents = (u32 *)memalloc(sizeof(u32)*(pin_count + 1));
+  for (u32 p = 0; p < pin_count; p++) parents[p] = p;
+
+  for (u32 g = 0; g < gate_count; g++) {
+    if (!in_hierarchy[g] || ops[g] != GATE_COMPOSITE) continue;
+    for (u32 p = 0; p < in_counts[g] + out_counts[g]; p++) {
+      Gate_Id pin_gate = gates->pin_gates[PIN(g, p)];
+      if (pin_gate != GATE_NONE) pin_set_union(parents, PIN(g, p), PIN(pin_gate, 0));
+    }
+  }
+
+  // instance outputs wired straight to an input inside the definition
+  for (u32 g = 0; g < gate_count; g++) {
+    if (!in_hierarchy[g] || defs[g] == GATE_NONE || !gates->def_netlists[defs[g]]) continue;
+    Netlist *def_net = gates->def_netlists[defs[g]];
+    for (u32 out = 0; out < out_counts[g]; out++) {
+      u32 signal = def_net->outputs[out];
+      if (signal >= NET_FIRST_INPUT && signal < netlist_first_state_signal(def_net)) {
+        pin_set_union(parents, PIN(g, in_counts[g] + out), PIN(g, signal - NET_FIRST_INPUT));
+      }
+    }
+  }
+
+  for (u32 w = 0; w < wire_count; w++) {
+    Wire *wire = wires + w;
+    if (wire->start == root || wire->end == root) continue;
+    if (!in_hierarchy[wire->start] || !in_hierarchy[wire->end]) continue;
+    pin_set_union(parents, PIN(wire->start, in_counts[wire->start] + wire->start_index),
+                  PIN(wire->end, wire->end_index));
+  }
+
+  // drivers are stored per set root as a provisional signal:
+  // inputs get their final signal, node n is tagged as node_tag + n
+  u32 undriven = 0xFFFFFFFF;
+  u32 *drivers = (u32 *)memalloc(sizeof(u32)*(pin_count + 1));
+  for (u32 p = 0; p < pin_count; p++) drivers[p] = undriven;
+
+  Netlist *net = &result->net;
+  net->input_count = in_counts[root];
+  for (u32 in = 0; in < in_counts[root]; in++) {
+    drivers[pin_set_find(parents, PIN(root, in))] = NET_FIRST_INPUT + in;
+  }
+
+  // AND/NOT gates become one node, a latch becomes LATCH_NODE_COUNT nodes
+  // around its own state, a flip-flop only owns a state and an instance
+  // gets a copy of its definition's nodes and states. Every driver has
+  // to be known before operands are resolved, so this takes two passes.
+#define LATCH_NODE_COUNT 7
+  u32 *gate_nodes = (u32 *)memalloc(sizeof(u32)*(gate_count + 1));
+  u32 *gate_states = (u32 *)memalloc(sizeof(u32)*(gate_count + 1));
+  u32 node_count = 0;
+  u32 state_count = 0;
+  for (u32 g = 0; g < gate_count; g++) {
+    if (!in_hierarchy[g] || g == root) continue;
+    gate_nodes[g] = node_count;
+    gate_states[g] = state_count;
+    switch (ops[g]) {
+      case GATE_AND:
+      case GATE_NOT: {
+        node_count++;
+      } break;
+      case GATE_LATCH: {
+        node_count += LATCH_NODE_COUNT;
+        state_count++;
+      } break;
+      case GATE_DFF: {
+        state_count++;
+      } break;
+      case GATE_INSTANCE: {
+        Netlist *def_net = gates->def_netlists[defs[g]];
+        if (def_net) {
+          node_count += def_net->node_count;
+          state_count += def_net->state_count;
+        }
+      } break;
+    }
+  }
+  net->state_count = state_count;
+  u32 first_state = netlist_first_state_signal(net);
+
+  u32 node_tag = 0x80000000;
+  for (u32 g = 0; g < gate_count; g++) {
+    if (!in_hierarchy[g] || g == root) continue;
+    u32 *out_driver = drivers + pin_set_find(parents, PIN(g, in_counts[g]));
+    switch (ops[g]) {
+      case GATE_AND:
+      case GATE_NOT: {
+        *out_driver = node_tag + gate_nodes[g];
+      } break;
+      case GATE_LATCH: {
+        *out_driver = node_tag + gate_nodes[g] + LATCH_NODE_COUNT - 1;
+      } break;
+      case GATE_DFF: {
+        *out_driver = first_state + gate_states[g];
+      } break;
+      case GATE_INSTANCE: {
+        Netlist *def_net = gates->def_netlists[defs[g]];
+        if (!def_net) break;
+        u32 def_first_state = netlist_first_state_signal(def_net);
+        u32 def_first_node = netlist_first_node_signal(def_net);
+        for (u32 out = 0; out < out_counts[g]; out++) {
+          u32 signal = def_net->outputs[out];
+          u32 *driver = drivers + pin_set_find(parents, PIN(g, in_counts[g] + out));
+          if (signal < NET_FIRST_INPUT) {
+            *driver = signal;
+          } else if (signal >= def_first_node) {
+            *driver = node_tag + gate_nodes[g] + signal - def_first_node;
+          } else if (signal >= def_first_state) {
+            *driver = first_state + gate_states[g] + signal - def_first_state;
+          }
+        }
+      } break;
+    }
+  }
+
+  // ops and operands in provisional signals
+  u8 *node_ops = (u8 *)memalloc(node_count + 1);
+  u32 *operands = (u32 *)memalloc(sizeof(u32)*2*(node_count + 1));
+  u32 *state_next = (u32 *)memalloc(sizeof(u32)*(state_count + 1));
+#define OPERAND(gate, in) pin_driver(drivers, parents, PIN(gate, in), undriven)
+#define SET_NODE(n, op, a, b) (node_ops[n] = (op), operands[(n)*2] = (a), operands[(n)*2 + 1] = (b))
+  for (u32 g = 0; g < gate_count; g++) {
+    if (!in_hierarchy[g] || g == root) continue;
+    u32 n = gate_nodes[g];
+    switch (ops[g]) {
+      case GATE_AND: {
+        SET_NODE(n, NET_AND, OPERAND(g, 0), OPERAND(g, 1));
+      } break;
+      case GATE_NOT: {
+        SET_NODE(n, NET_NOT, OPERAND(g, 0), NET_CONST_1);
+      } break;
+      case GATE_LATCH: {
+        // q = enable ? d : state, as NOT(AND(NOT(AND(enable, d)), NOT(AND(NOT enable, state))))
+        u32 d = OPERAND(g, 0);
+        u32 enable = OPERAND(g, 1);
+        u32 tag = node_tag + n;
+        SET_NODE(n + 0, NET_AND, enable, d);
+        SET_NODE(n + 1, NET_NOT, enable, NET_CONST_1);
+        SET_NODE(n + 2, NET_AND, tag + 1, first_state + gate_states[g]);
+        SET_NODE(n + 3, NET_NOT, tag + 0, NET_CONST_1);
+        SET_NODE(n + 4, NET_NOT, tag + 2, NET_CONST_1);
+        SET_NODE(n + 5, NET_AND, tag + 3, tag + 4);
+        SET_NODE(n + 6, NET_NOT, tag + 5, NET_CONST_1);
+        state_next[gate_states[g]] = tag + LATCH_NODE_COUNT - 1;
+      } break;
+      case GATE_DFF: {
+        state_next[gate_states[g]] = OPERAND(g, 0);
+      } break;
+      case GATE_INSTANCE: {
+        Netlist *def_net = gates->def_netlists[defs[g]];
+        if (!def_net) break;
+        u32 def_first_state = netlist_first_state_signal(def_net);
+        u32 def_first_node = netlist_first_node_signal(def_net);
+#define INSTANCE_SIGNAL(s) ((s) < NET_FIRST_INPUT ? (s) : \
+                            (s) < def_first_state ? OPERAND(g, (s) - NET_FIRST_INPUT) : \
+                            (s) < def_first_node ? first_state + gate_states[g] + (s) - def_first_state : \
+                            node_tag + n + (s) - def_first_node)
+        for (u32 i = 0; i < def_net->node_count; i++) {
+          SET_NODE(n + i, def_net->ops[i], INSTANCE_SIGNAL(def_net->in0[i]), INSTANCE_SIGNAL(def_net->in1[i]));
+        }
+        for (u32 i = 0; i < def_net->state_count; i++) {
+          state_next[gate_states[g] + i] = INSTANCE_SIGNAL(def_net->state_next[i]);
+        }
+#undef INSTANCE_SIGNAL
+      } break;
+    }
+  }
+#undef SET_NODE
+#undef OPERAND
+#undef LATCH_NODE_COUNT
+
+  // kahn levelization over node -> node edges
+  u32 *fanout_offsets = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  memset(fanout_offsets, 0, sizeof(u32)*(node_count + 1));
+  u32 *pending = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  memset(pending, 0, sizeof(u32)*(node_count + 1));
+  for (u32 i = 0; i < node_count*2; i++) {
+    if (operands[i] >= node_tag) {
+      fanout_offsets[operands[i] - node_tag]++;
+      pending[i/2]++;
+    }
+  }
+  u32 edge_count = 0;
+  for (u32 n = 0; n < node_count; n++) {
+    u32 count = fanout_offsets[n];
+    fanout_offsets[n] = edge_count;
+    edge_count += count;
+  }
+  fanout_offsets[node_count] = edge_count;
+  u32 *fanouts = (u32 *)memalloc(sizeof(u32)*(edge_count + 1));
+  u32 *cursors = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  memcpy(cursors, fanout_offsets, sizeof(u32)*(node_count + 1));
+  for (u32 i = 0; i < node_count*2; i++) {
+    if (operands[i] >= node_tag) {
+      fanouts[cursors[operands[i] - node_tag]++] = i/2;
+    }
+  }
+
+  u32 *levels = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  u32 *order = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+  u32 order_count = 0;
+  for (u32 n = 0; n < node_count; n++) {
+    levels[n] = 0;
+    if (!pending[n]) order[order_count++] = n;
+  }
+  u32 level_count = node_count ? 1 : 0;
+  for (u32 i = 0; i < order_count; i++) {
+    u32 n = order[i];
+    for (u32 e = fanout_offsets[n]; e < fanout_offsets[n + 1]; e++) {
+      u32 fanout = fanouts[e];
+      levels[fanout] = max(levels[fanout], levels[n] + 1);
+      level_count = max(level_count, levels[fanout] + 1);
+      if (--pending[fanout] == 0) order[order_count++] = fanout;
+    }
+  }
+
+  if (status != CIRCUIT_COMPILE_OK || order_count != node_count) {
+    status = CIRCUIT_COMPILE_COMBINATIONAL_LOOP;
+  } else {
+    // counting sort of nodes by level, new_index maps old node -> new node
+    net->node_count = node_count;
+    net->level_count = level_count;
+    net->level_offsets = (u32 *)memalloc(sizeof(u32)*(level_count + 1));
+    memset(net->level_offsets, 0, sizeof(u32)*(level_count + 1));
+    for (u32 n = 0; n < node_count; n++) net->level_offsets[levels[n] + 1]++;
+    for (u32 l = 0; l < level_count; l++) net->level_offsets[l + 1] += net->level_offsets[l];
+
+    u32 *new_index = cursors;
+    memcpy(pending, net->level_offsets, sizeof(u32)*level_count);
+    for (u32 n = 0; n < node_count; n++) new_index[n] = pending[levels[n]]++;
+
+    u32 first_node = netlist_first_node_signal(net);
+#define FINAL_SIGNAL(s) ((s) >= node_tag ? first_node + new_index[(s) - node_tag] : (s))
+
+    net->ops = (u8 *)memalloc(node_count + 1);
+    net->in0 = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+    net->in1 = (u32 *)memalloc(sizeof(u32)*(node_count + 1));
+    for (u32 n = 0; n < node_count; n++) {
+      u32 i = new_index[n];
+      net->ops[i] = node_ops[n];
+      net->in0[i] = FINAL_SIGNAL(operands[n*2]);
+      net->in1[i] = FINAL_SIGNAL(operands[n*2 + 1]);
+    }
+
+    net->state_next = (u32 *)memalloc(sizeof(u32)*(state_count + 1));
+    for (u32 i = 0; i < state_count; i++) {
+      net->state_next[i] = FINAL_SIGNAL(state_next[i]);
+    }
+
+    net->output_count = out_counts[root];
+    net->outputs = (u32 *)memalloc(sizeof(u32)*(out_counts[root] + 1));
+    for (u32 out = 0; out < out_counts[root]; out++) {
+      u32 signal = drivers[pin_set_find(parents, PIN(root, in_counts[root] + out))];
+      net->outputs[out] = signal == undriven ? NET_CONST_0 : FINAL_SIGNAL(signal);
+    }
+
+    u32 *pin_signals = (u32 *)memalloc(sizeof(u32)*(pin_count + 1));
+    for (u32 g = 0; g < gate_count; g++) {
+      for (u32 p = PIN(g, 0); p < PIN(g, in_counts[g] + out_counts[g]); p++) {
+        u32 signal = in_hierarchy[g] ? drivers[pin_set_find(parents, p)] : undriven;
+        pin_signals[p] = signal == undriven ? NET_CONST_0 : FINAL_SIGNAL(signal);
+      }
+    }
+#undef FINAL_SIGNAL
+
+    result->pin_signals = pin_signals;
+
+    netlist_build_fanouts(net);
+    circuit_alloc_buffers(result);
+  }
+#undef PIN
+
+  memfree(in_hierarchy);
+  memfree(stack);
+  memfree(parents);
+  memfree(drivers);
+  memfree(gate_nodes);
+  memfree(gate_states);
+  memfree(node_ops);
+  memfree(operands);
+  memfree(state_next);
+  memfree(fanout_offsets);
+  memfree(pending);
+  memfree(fanouts);
+  memfree(cursors);
+  memfree(levels);
+  memfree(order);
+
+  return status;
+}
+
+// Compiles a definition once, every instance of it copies the nodes of
+// the returned netlist. Returns nullptr if the definition has a loop.
+Netlist *netlist_compile_def(Gate_Store *gates, Wire *wires, u32 wire_count, Gate_Id def) {
+  Netlist *result = nullptr;
+  Circuit circuit;
+  if (circuit_compile(gates, wires, wire_count, def, &circuit) == CIRCUIT_COMPILE_OK) {
+    result = (Netlist *)memalloc(sizeof(Netlist));
+    *result = circuit.net;
+    circuit.net = {};
+  }
+  circuit_free(&circuit);
+  return result;
+}
+
+void circuit_set_input(Circuit *circuit, u32 in_index, bool value) {
+  assert(in_index < circuit->net.input_count);
+  circuit->values[NET_FIRST_INPUT + in_index] = value;
+}
+
+bool circuit_get_input(Circuit *circuit, u32 in_index) {
+  assert(in_index < circuit->net.input_count);
+  bool result = circuit->values[NET_FIRST_INPUT + in_index];
+  return result;
+}
+
+bool circuit_get_output(Circuit *circuit, u32 out_index) {
+  assert(out_index < circuit->net.output_count);
+  bool result = circuit->values[circuit->net.outputs[out_index]];
+  return result;
+}
+
+bool circuit_get_pin(Circuit *circuit, Gate_Id gate, u32 pin_index) {
+  u32 pin = circuit->gates->pin_offsets[gate] + pin_index;
+  assert(pin < circuit->pin_count);
+  bool result = circuit->values[circuit->pin_signals[pin]];
+  return result;
+}
+
+void circuit_eval(Circuit *circuit) {
+  netlist_eval(&circuit->net, circuit->values);
+}
+
+// Clocks every flip-flop and latch cycle_count times, values must be
+// evaluated (circuit_eval or circuit_propagate after input changes).
+void circuit_step(Circuit *circuit, u32 cycle_count) {
+  netlist_step_lanes(&circuit->net, circuit->values, circuit->next_state, cycle_count);
+}
+
+bool circuit_get_state(Circuit *circuit, u32 state_index) {
+  assert(state_index < circuit->net.state_count);
+  bool result = circuit->values[netlist_first_state_signal(&circuit->net) + state_index];
+  return result;
+}
+
+void circuit_schedule_fanouts(Circuit *circuit, u32 signal) {
+  Netlist *net = &circuit->net;
+  for (u32 e = net->fanout_offsets[signal]; e < net->fanout_offsets[signal + 1]; e++) {
+    u32 n = net->fanouts[e];
+    if (!circuit->queued[n]) {
+      circuit->queued[n] = true;
+      u32 level = net->node_levels[n];
+      circuit->queue[net->level_offsets[level] + circuit->queue_counts[level]++] = n;
+      circuit->first_dirty_level = min(circuit->first_dirty_level, level);
+    }
+  }
+}
+
+// Sets an input and queues the nodes reading it, circuit_propagate applies it.
+void circuit_change_input(Circuit *circuit, u32 in_index, bool value) {
+  assert(in_index < circuit->net.input_count);
+  u32 signal = NET_FIRST_INPUT + in_index;
+  if (circuit->values[signal] != value) {
+    circuit->values[signal] = value;
+    circuit_schedule_fanouts(circuit, signal);
+  }
+}
+
+// Event-driven update after circuit_change_input: levels are processed in
+// order, a node's fan-out is only queued when its value actually changed.
+// Node inputs always come from lower levels, so a level's queue is complete
+// by the time it is reached. Returns the number of nodes evaluated.
+u32 circuit_propagate(Circuit *circuit) {
+  Netlist *net = &circuit->net;
+  u8 *values = circuit->values;
+  u32 first_node = netlist_first_node_signal(net);
+  u32 evaluated = 0;
+
+  for (u32 level = circuit->first_dirty_level; level < net->level_count; level++) {
+    u32 *level_queue = circuit->queue + net->level_offsets[level];
+    for (u32 i = 0; i < circuit->queue_counts[level]; i++) {
+      u32 n = level_queue[i];
+      circuit->queued[n] = false;
+      u8 value = (u8)((values[net->in0[n]] & values[net->in1[n]]) ^ net->ops[n]);
+      if (value != values[first_node + n]) {
+        values[first_node + n] = value;
+        circuit_schedule_fanouts(circuit, first_node + n);
+      }
+    }
+    evaluated += circuit->queue_counts[level];
+    circuit->queue_counts[level] = 0;
+  }
+  circuit->first_dirty_level = net->level_count;
+
+  return evaluated;
+}
+
+// Optimizes the compiled netlist, pins keep reading the same values.
+// Inputs and states are kept, everything else is re-evaluated.
+void circuit_optimize(Circuit *circuit, Netlist_Optimize_Stats *stats) {
+  Netlist *net = &circuit->net;
+  u32 source_count = netlist_first_node_signal(net);
+  u8 *sources = (u8 *)memalloc(source_count);
+  memcpy(sources, circuit->values, source_count);
+
+  netlist_optimize(net, circuit->pin_signals, circuit->pin_count, stats);
+  circuit_alloc_buffers(circuit);
+
+  memcpy(circuit->values, sources, source_count);
+  netlist_eval(net, circuit->values);
+  memfree(sources);
+}
@@ -0,0 +1,848 @@
+// Gate/Wire graphs with hierarchical definitions, as text or binary.
+//
+// Text, one record per line, '#' starts a comment:
+//   lvl5net 1 <def_count> <gate_count> <wire_count> <pin_count>
+//   def <name> <in_count> <out_count> <child_count> <wire_count>
+//   g <kind> [<pin>] <x> <y>       kind: and not dff latch in out <def name>
+//   w <start> <start_pin> <end> <end_pin>
+//   top <name>
+// Children are numbered in the order of their g lines, in/out take the
+// pin of the definition they stand for. A definition has to come before
+// its first instance, and its name is one word that isn't a primitive
+// kind, export renames the ones that aren't. The header counts cover
+// every definition and child, so a load reserves the gate store once.
+//
+// Binary is the same records as little endian u32/f32:
+//   magic, version, def_count, gate_count, wire_count, pin_count,
+//   per def: name_length, name padded to 4 bytes, in_count, out_count,
+//            child_count, wire_count, children (kind, pin, x, y), wires
+//   top def index
+// where kind is a Netlist_Gate_Kind, NETLIST_KIND_FIRST_DEF + k for def k.
+
+#include <stdarg.h>
+
+#define NETLIST_TEXT_VERSION 1
+#define NETLIST_BINARY_MAGIC 0x424E354C // "L5NB"
+#define NETLIST_BINARY_VERSION 1
+
+enum Netlist_Gate_Kind : u32 {
+  NETLIST_KIND_AND,
+  NETLIST_KIND_NOT,
+  NETLIST_KIND_DFF,
+  NETLIST_KIND_LATCH,
+  NETLIST_KIND_IN,
+  NETLIST_KIND_OUT,
+
+  NETLIST_KIND_FIRST_DEF = 16,
+};
+
+enum Netlist_Load_Result {
+  NETLIST_LOAD_OK,
+  NETLIST_LOAD_SYNTAX_ERROR,
+  NETLIST_LOAD_UNKNOWN_DEF,
+  NETLIST_LOAD_BAD_INDEX,
+  NETLIST_LOAD_COUNT_MISMATCH,
+};
+
+// Appends definitions to a State, the gate store is reserved up front
+// from the header counts and every count is checked against them.
+struct Netlist_Builder {
+  State *state;
+  // what the state held before, restored on failure
+  u32 first_gate;
+  u32 first_pin;
+  u32 first_wire;
+
+  u32 gate_limit;
+  u32 pin_limit;
+  u32 wires_left_total;
+
+  Gate_Id *defs;
+  u32 def_count;
+  u32 def_capacity;
+  Hash_Map<const char *, u32> def_indices; // name -> newest definition with it
+
+  Gate_Id def;
+  u32 def_first_child;
+  u32 children_left;
+  u32 wires_left;
+};
+
+// input_left is what follows the header, every definition record takes
+// at least def_size bytes of it and every child or wire record_size, so
+// counts the input can't hold are rejected before anything is reserved.
+Netlist_Load_Result netlist_builder_begin(Netlist_Builder *builder, State *state, u32 def_count,
+                                          u32 gate_count, u32 wire_count, u32 pin_count,
+                                          u64 input_left, u64 def_size, u64 record_size) {
+  // definitions are gates too
+  if (def_count > gate_count ||
+      def_count*def_size + ((u64)gate_count - def_count + wire_count)*record_size > input_left ||
+      (u64)state->gates.count + gate_count > 0xFFFFFFFF ||
+      (u64)state->gates.pin_count + pin_count > 0xFFFFFFFF) {
+    return NETLIST_LOAD_COUNT_MISMATCH;
+  }
+
+  *builder = {
+    .state = state,
+    .first_gate = state->gates.count,
+    .first_pin = state->gates.pin_count,
+    .first_wire = state->wires.items.count,
+    .gate_limit = state->gates.count + gate_count,
+    .pin_limit = state->gates.pin_count + pin_count,
+    .wires_left_total = wire_count,
+    .def_capacity = def_count,
+    .def = GATE_NONE,
+  };
+  // an instance has as many pins as its definition, so the pin count isn't
+  // bound by the input. Past what primitives would need they are reserved
+  // as the instances come, and those are bound by the input again.
+  reserve_gates(state, gate_count, (u32)min((u64)pin_count, 3*(u64)gate_count));
+  slot_map_reserve(&state->wires, state->wires.items.count + wire_count);
+  builder->defs = (Gate_Id *)memalloc(sizeof(Gate_Id)*(def_count + 1));
+  builder->def_indices = make_hash_map<const char *, u32>(def_count);
+  return NETLIST_LOAD_OK;
+}
+
+// Index of the newest definition called name, def_count when there is none.
+u32 netlist_builder_find_def(Netlist_Builder *builder, char *name, u32 name_length) {
+  Mem_Size scratch_mark = scratch_get_mark();
+  char *key = (char *)scratch_alloc(name_length + 1);
+  memcpy(key, name, name_length);
+  key[name_length] = 0;
+  u32 *index = hash_map_get(&builder->def_indices, (const char *)key);
+  u32 result = index ? *index : builder->def_count;
+  scratch_set_mark(scratch_mark);
+  return result;
+}
+
+Gate_Id netlist_builder_make_gate(Netlist_Builder *builder, Gate_Op op, const char *name, u32 ins, u32 outs) {
+  Gate_Id result = GATE_NONE;
+  Gate_Store *gates = &builder->state->gates;
+  if (gates->count < builder->gate_limit && gates->pin_count + ins + outs <= builder->pin_limit) {
+    result = append_gate(builder->state, builder->def, op, name, ins, outs);
+  }
+  return result;
+}
+
+Netlist_Load_Result netlist_builder_end_def(Netlist_Builder *builder) {
+  Netlist_Load_Result result = NETLIST_LOAD_OK;
+  if (builder->def != GATE_NONE && (builder->children_left || builder->wires_left)) {
+    result = NETLIST_LOAD_COUNT_MISMATCH;
+  }
+  builder->def = GATE_NONE;
+  return result;
+}
+
+Netlist_Load_Result netlist_builder_def(Netlist_Builder *builder, char *name, u32 name_length,
+                                        u32 ins, u32 outs, u32 child_count, u32 wire_count) {
+  Netlist_Load_Result result = netlist_builder_end_def(builder);
+  // every pin stands for an in or out child
+  if (result == NETLIST_LOAD_OK &&
+      (builder->def_count == builder->def_capacity || wire_count > builder->wires_left_total ||
+       (u64)ins + outs > child_count)) {
+    result = NETLIST_LOAD_COUNT_MISMATCH;
+  }
+
+  if (result == NETLIST_LOAD_OK) {
+    char *def_name = (char *)memalloc(name_length + 1);
+    memcpy(def_name, name, name_length);
+    def_name[name_length] = 0;
+
+    Gate_Id def = netlist_builder_make_gate(builder, GATE_COMPOSITE, def_name, ins, outs);
+    if (def != GATE_NONE) {
+      hash_map_put(&builder->def_indices, (const char *)def_name, builder->def_count);
+      builder->defs[builder->def_count++] = def;
+      builder->def = def;
+      builder->def_first_child = builder->state->gates.count;
+      builder->children_left = child_count;
+      builder->wires_left = wire_count;
+      builder->wires_left_total -= wire_count;
+    } else {
+      memfree(def_name);
+      result = NETLIST_LOAD_COUNT_MISMATCH;
+    }
+  }
+  return result;
+}
+
+Netlist_Load_Result netlist_builder_gate(Netlist_Builder *builder, u32 kind, u32 pin, V2 p) {
+  State *state = builder->state;
+  Gate_Store *gates = &state->gates;
+  Gate_Id def = builder->def;
+  if (def == GATE_NONE || !builder->children_left) return NETLIST_LOAD_COUNT_MISMATCH;
+
+  Gate_Id gate = GATE_NONE;
+  switch (kind) {
+    case NETLIST_KIND_AND: gate = netlist_builder_make_gate(builder, GATE_AND, "and", 2, 1); break;
+    case NETLIST_KIND_NOT: gate = netlist_builder_make_gate(builder, GATE_NOT, "not", 1, 1); break;
+    case NETLIST_KIND_DFF: gate = netlist_builder_make_gate(builder, GATE_DFF, "dff", 1, 1); break;
+    case NETLIST_KIND_LATCH: gate = netlist_builder_make_gate(builder, GATE_LATCH, "latch", 2, 1); break;
+
+    case NETLIST_KIND_IN: {
+      if (pin >= gates->in_counts[def]) return NETLIST_LOAD_BAD_INDEX;
+      gate = netlist_builder_make_gate(builder, GATE_IN, "in", 0, 1);
+      if (gate != GATE_NONE) gates->pin_gates[gates->pin_offsets[def] + pin] = gate;
+    } break;
+
+    case NETLIST_KIND_OUT: {
+      if (pin >= gates->out_counts[def]) return NETLIST_LOAD_BAD_INDEX;
+      gate = netlist_builder_make_gate(builder, GATE_OUT, "out", 1, 0);
+      if (gate != GATE_NONE) gates->pin_gates[gates->pin_offsets[def] + gates->in_counts[def] + pin] = gate;
+    } break;
+
+    default: {
+      // only definitions before the current one can be instanced
+      if (kind < NETLIST_KIND_FIRST_DEF || kind - NETLIST_KIND_FIRST_DEF >= builder->def_count - 1) {
+        return NETLIST_LOAD_UNKNOWN_DEF;
+      }
+      Gate_Id instanced = builder->defs[kind - NETLIST_KIND_FIRST_DEF];
+      gate = netlist_builder_make_gate(builder, GATE_INSTANCE, state->layout.names[instanced],
+                                       gates->in_counts[instanced], gates->out_counts[instanced]);
+      if (gate != GATE_NONE) gates->defs[gate] = instanced;
+    } break;
+  }
+  if (gate == GATE_NONE) return NETLIST_LOAD_COUNT_MISMATCH;
+
+  state->layout.positions[gate] = p;
+  builder->children_left--;
+  return NETLIST_LOAD_OK;
+}
+
+Netlist_Load_Result netlist_builder_wire(Netlist_Builder *builder, u32 start, u32 start_pin,
+                                         u32 end, u32 end_pin) {
+  State *state = builder->state;
+  Gate_Store *gates = &state->gates;
+  if (builder->def == GATE_NONE || !builder->wires_left) {
+    return NETLIST_LOAD_COUNT_MISMATCH;
+  }
+  // children are created in order, so local indices only reach defined ones
+  u32 child_count = gates->count - builder->def_first_child;
+  if (start >= child_count || end >= child_count) return NETLIST_LOAD_BAD_INDEX;
+
+  start += builder->def_first_child;
+  end += builder->def_first_child;
+  if (start_pin >= gates->out_counts[start] || end_pin >= gates->in_counts[end]) {
+    return NETLIST_LOAD_BAD_INDEX;
+  }
+
+  // not connect, the wire index is left to be rebuilt in one pass
+  slot_map_add(&state->wires, {start, start_pin, end, end_pin});
+  gates->edit_version++;
+  builder->wires_left--;
+  return NETLIST_LOAD_OK;
+}
+
+Netlist_Load_Result netlist_builder_finish(Netlist_Builder *builder, u32 top, Gate_Id *result) {
+  Netlist_Load_Result status = netlist_builder_end_def(builder);
+  if (status == NETLIST_LOAD_OK) {
+    if (top < builder->def_count) {
+      *result = builder->defs[top];
+    } else {
+      status = NETLIST_LOAD_UNKNOWN_DEF;
+    }
+  }
+  return status;
+}
+
+// Removes everything the builder added to the state. Loaded gates are
+// only ever appended and linked among themselves, so truncating is enough.
+void netlist_builder_rollback(Netlist_Builder *builder) {
+  State *state = builder->state;
+  if (!state) return;
+  for (u32 i = 0; i < builder->def_count; i++) {
+    memfree((void *)state->layout.names[builder->defs[i]]);
+  }
+  Slot_Map<Wire> *wires = &state->wires;
+  while (wires->items.count > builder->first_wire) slot_map_remove_at(wires, wires->items.count - 1);
+  state->gates.count = builder->first_gate;
+  state->gates.pin_count = builder->first_pin;
+  state->gates.edit_version++;
+}
+
+void netlist_builder_free(Netlist_Builder *builder) {
+  if (builder->defs) memfree(builder->defs);
+  hash_map_free(&builder->def_indices);
+  *builder = {};
+}
+
+// NOTE: single pass tokenizer over the whole text, nothing is copied
+// except definition names
+struct Netlist_Text_Reader {
+  char *at;
+  char *end;
+  u32 line;
+};
+
+bool netlist_is_space(char c) {
+  bool result = c == ' ' || c == '\t' || c == '\r';
+  return result;
+}
+
+void netlist_skip_space(Netlist_Text_Reader *reader) {
+  while (reader->at < reader->end && netlist_is_space(*reader->at)) reader->at++;
+  if (reader->at < reader->end && *reader->at == '#') {
+    while (reader->at < reader->end && *reader->at != '\n') reader->at++;
+  }
+}
+
+// skips blank and comment lines, false at the end of the text
+bool netlist_next_line(Netlist_Text_Reader *reader) {
+  netlist_skip_space(reader);
+  while (reader->at < reader->end && *reader->at == '\n') {
+    reader->at++;
+    reader->line++;
+    netlist_skip_space(reader);
+  }
+  bool result = reader->at < reader->end;
+  return result;
+}
+
+bool netlist_end_line(Netlist_Text_Reader *reader) {
+  netlist_skip_space(reader);
+  bool result = reader->at == reader->end || *reader->at == '\n';
+  return result;
+}
+
+u32 netlist_read_word(Netlist_Text_Reader *reader, char **word) {
+  netlist_skip_space(reader);
+  *word = reader->at;
+  while (reader->at < reader->end && !netlist_is_space(*reader->at) &&
+         *reader->at != '\n' && *reader->at != '#') {
+    reader->at++;
+  }
+  u32 result = (u32)(reader->at - *word);
+  return result;
+}
+
+bool netlist_word_is(char *word, u32 length, const char *keyword) {
+  bool result = strlen(keyword) == length && memcmp(word, keyword, length) == 0;
+  return result;
+}
+
+bool netlist_read_u32(Netlist_Text_Reader *reader, u32 *result) {
+  netlist_skip_space(reader);
+  u64 value = 0;
+  char *start = reader->at;
+  while (reader->at < reader->end && *reader->at >= '0' && *reader->at <= '9' && value <= 0xFFFFFFFF) {
+    value = value*10 + (u64)(*reader->at++ - '0');
+  }
+  *result = (u32)value;
+  bool ok = reader->at != start && value <= 0xFFFFFFFF;
+  return ok;
+}
+
+// [-]digits[.digits][e[-]digits], which covers everything %g writes
+bool netlist_read_f32(Netlist_Text_Reader *reader, f32 *result) {
+  netlist_skip_space(reader);
+  char *at = reader->at;
+  char *end = reader->end;
+  f64 sign = 1;
+  if (at < end && (*at == '-' || *at == '+')) sign = *at++ == '-' ? -1 : 1;
+
+  char *digits_start = at;
+  f64 value = 0;
+  while (at < end && *at >= '0' && *at <= '9') value = value*10 + (*at++ - '0');
+  if (at < end && *at == '.') {
+    at++;
+    f64 scale = 0.1;
+    while (at < end && *at >= '0' && *at <= '9') {
+      value += (*at++ - '0')*scale;
+      scale *= 0.1;
+    }
+  }
+  bool ok = at != digits_start;
+
+  if (ok && at < end && (*at == 'e' || *at == 'E')) {
+    at++;
+    i32 exponent_sign = 1;
+    if (at < end && (*at == '-' || *at == '+')) exponent_sign = *at++ == '-' ? -1 : 1;
+    i32 exponent = 0;
+    char *exponent_start = at;
+    while (at < end && *at >= '0' && *at <= '9' && exponent < 1000) exponent = exponent*10 + (*at++ - '0');
+    ok = at != exponent_start;
+    value *= pow(10.0, (f64)(exponent_sign*exponent));
+  }
+
+  reader->at = at;
+  *result = (f32)(sign*value);
+  return ok;
+}
+
+// Appends the definitions to state, *top is the top definition.
+// On failure the state is left as it was and *error_line is the line.
+Netlist_Load_Result netlist_load_text(State *state, char *text, u32 size, Gate_Id *top, u32 *error_line) {
+  Netlist_Text_Reader reader = {text, text + size, 1};
+  Netlist_Builder builder = {};
+  Netlist_Load_Result result = NETLIST_LOAD_SYNTAX_ERROR;
+  bool done = false;
+
+  char *word;
+  u32 word_length;
+  u32 version, def_count, gate_count, wire_count, pin_count;
+  if (netlist_next_line(&reader) && (word_length = netlist_read_word(&reader, &word)) &&
+      netlist_word_is(word, word_length, "lvl5net") &&
+      netlist_read_u32(&reader, &version) && version == NETLIST_TEXT_VERSION &&
+      netlist_read_u32(&reader, &def_count) && netlist_read_u32(&reader, &gate_count) &&
+      netlist_read_u32(&reader, &wire_count) && netlist_read_u32(&reader, &pin_count) &&
+      netlist_end_line(&reader)) {
+    // every record is a line of at least one byte
+    result = netlist_builder_begin(&builder, state, def_count, gate_count, wire_count, pin_count,
+                                   (u64)(reader.end - reader.at), 1, 1);
+  }
+
+  while (result == NETLIST_LOAD_OK && !done && netlist_next_line(&reader)) {
+    result = NETLIST_LOAD_SYNTAX_ERROR;
+    word_length = netlist_read_word(&reader, &word);
+
+    if (netlist_word_is(word, word_length, "g")) {
+      u32 kind = 0;
+      u32 pin = 0;
+      V2 p;
+      char *kind_word;
+      u32 kind_length = netlist_read_word(&reader, &kind_word);
+      bool ok = true;
+      if (netlist_word_is(kind_word, kind_length, "and")) {
+        kind = NETLIST_KIND_AND;
+      } else if (netlist_word_is(kind_word, kind_length, "not")) {
+        kind = NETLIST_KIND_NOT;
+      } else if (netlist_word_is(kind_word, kind_length, "dff")) {
+        kind = NETLIST_KIND_DFF;
+      } else if (netlist_word_is(kind_word, kind_length, "latch")) {
+        kind = NETLIST_KIND_LATCH;
+      } else if (netlist_word_is(kind_word, kind_length, "in")) {
+        kind = NETLIST_KIND_IN;
+        ok = netlist_read_u32(&reader, &pin);
+      } else if (netlist_word_is(kind_word, kind_length, "out")) {
+        kind = NETLIST_KIND_OUT;
+        ok = netlist_read_u32(&reader, &pin);
+      } else {
+        u32 def_index = netlist_builder_find_def(&builder, kind_word, kind_length);
+        if (def_index == builder.def_count) {
+          result = NETLIST_LOAD_UNKNOWN_DEF;
+          break;
+        }
+        kind = NETLIST_KIND_FIRST_DEF + def_index;
+      }
+
+      if (ok && netlist_read_f32(&reader, &p.x) && netlist_read_f32(&reader, &p.y) &&
+          netlist_end_line(&reader)) {
+        result = netlist_builder_gate(&builder, kind, pin, p);
+      }
+    } else if (netlist_word_is(word, word_length, "w")) {
+      u32 start, start_pin, end, end_pin;
+      if (netlist_read_u32(&reader, &start) && netlist_read_u32(&reader, &start_pin) &&
+          netlist_read_u32(&reader, &end) && netlist_read_u32(&reader, &end_pin) &&
+          netlist_end_line(&reader)) {
+        result = netlist_builder_wire(&builder, start, start_pin, end, end_pin);
+      }
+    } else if (netlist_word_is(word, word_length, "def")) {
+      char *name;
+      u32 name_length = netlist_read_word(&reader, &name);
+      u32 ins, outs, child_count, def_wire_count;
+      if (name_length && netlist_read_u32(&reader, &ins) && netlist_read_u32(&reader, &outs) &&
+          netlist_read_u32(&reader, &child_count) && netlist_read_u32(&reader, &def_wire_count) &&
+          netlist_end_line(&reader)) {
+        result = netlist_builder_def(&builder, name, name_length, ins, outs, child_count, def_wire_count);
+      }
+    } else if (netlist_word_is(word, word_length, "top")) {
+      char *name;
+      u32 name_length = netlist_read_word(&reader, &name);
+      if (name_length && netlist_end_line(&reader)) {
+        u32 top_index = netlist_builder_find_def(&builder, name, name_length);
+        result = netlist_builder_finish(&builder, top_index, top);
+        done = true;
+      }
+    }
+  }
+
+  if (result == NETLIST_LOAD_OK && !done) result = NETLIST_LOAD_SYNTAX_ERROR;
+  if (result != NETLIST_LOAD_OK) netlist_builder_rollback(&builder);
+  netlist_builder_free(&builder);
+  *error_line = reader.line;
+  return result;
+}
+
+struct Netlist_Binary_Reader {
+  u8 *at;
+  u8 *end;
+};
+
+bool netlist_read_binary_u32(Netlist_Binary_Reader *reader, u32 *result) {
+  bool ok = reader->end - reader->at >= 4;
+  if (ok) {
+    u32 value;
+    memcpy(&value, reader->at, 4);
+    *result = value;
+    reader->at += 4;
+  }
+  return ok;
+}
+
+// Like netlist_load_text, for what netlist_export writes in binary.
+Netlist_Load_Result netlist_load_binary(State *state, u8 *data, u32 size, Gate_Id *top) {
+  Netlist_Binary_Reader reader = {data, data + size};
+  Netlist_Builder builder = {};
+  Netlist_Load_Result result = NETLIST_LOAD_SYNTAX_ERROR;
+
+  u32 magic, version, def_count, gate_count, wire_count, pin_count;
+  if (netlist_read_binary_u32(&reader, &magic) && magic == NETLIST_BINARY_MAGIC &&
+      netlist_read_binary_u32(&reader, &version) && version == NETLIST_BINARY_VERSION &&
+      netlist_read_binary_u32(&reader, &def_count) && netlist_read_binary_u32(&reader, &gate_count) &&
+      netlist_read_binary_u32(&reader, &wire_count) && netlist_read_binary_u32(&reader, &pin_count)) {
+    // a definition is at least its name length, a padded name and four counts,
+    // a child or a wire is four words
+    result = netlist_builder_begin(&builder, state, def_count, gate_count, wire_count, pin_count,
+                                   (u64)(reader.end - reader.at), 24, 16);
+  }
+
+  for (u32 def_index = 0; result == NETLIST_LOAD_OK && def_index < def_count; def_index++) {
+    result = NETLIST_LOAD_SYNTAX_ERROR;
+    u32 name_length, ins, outs, child_count, def_wire_count;
+    if (!netlist_read_binary_u32(&reader, &name_length) || !name_length) break;
+    char *name = (char *)reader.at;
+    u64 padded_length = ((u64)name_length + 3) & ~(u64)3;
+    if ((u64)(reader.end - reader.at) < padded_length) break;
+    reader.at += padded_length;
+
+    if (netlist_read_binary_u32(&reader, &ins) && netlist_read_binary_u32(&reader, &outs) &&
+        netlist_read_binary_u32(&reader, &child_count) && netlist_read_binary_u32(&reader, &def_wire_count)) {
+      result = netlist_builder_def(&builder, name, name_length, ins, outs, child_count, def_wire_count);
+    }
+    if ((u64)(reader.end - reader.at) < 16*((u64)child_count + def_wire_count)) {
+      result = NETLIST_LOAD_SYNTAX_ERROR;
+    }
+
+    for (u32 i = 0; result == NETLIST_LOAD_OK && i < child_count; i++) {
+      u32 kind, pin;
+      V2 p;
+      netlist_read_binary_u32(&reader, &kind);
+      netlist_read_binary_u32(&reader, &pin);
+      memcpy(&p, reader.at, sizeof(V2));
+      reader.at += sizeof(V2);
+      result = netlist_builder_gate(&builder, kind, pin, p);
+    }
+    for (u32 i = 0; result == NETLIST_LOAD_OK && i < def_wire_count; i++) {
+      u32 wire[4];
+      memcpy(wire, reader.at, sizeof(wire));
+      reader.at += sizeof(wire);
+      result = netlist_builder_wire(&builder, wire[0], wire[1], wire[2], wire[3]);
+    }
+  }
+
+  u32 top_index;
+  if (result == NETLIST_LOAD_OK) {
+    result = netlist_read_binary_u32(&reader, &top_index) ? netlist_builder_finish(&builder, top_index, top)
+                                                           : NETLIST_LOAD_SYNTAX_ERROR;
+  }
+  if (result != NETLIST_LOAD_OK) netlist_builder_rollback(&builder);
+  netlist_builder_free(&builder);
+  return result;
+}
+
+
+struct Netlist_Writer {
+  u8 *data;
+  u32 count;
+  u32 capacity;
+};
+
+void netlist_writer_reserve(Netlist_Writer *writer, u32 size) {
+  if (writer->count + size > writer->capacity) {
+    u32 capacity = max(writer->capacity*2, writer->count + size);
+    u8 *data = (u8 *)memalloc(capacity);
+    if (writer->data) {
+      memcpy(data, writer->data, writer->count);
+      memfree(writer->data);
+    }
+    writer->data = data;
+    writer->capacity = capacity;
+  }
+}
+
+void netlist_write_bytes(Netlist_Writer *writer, void *data, u32 size) {
+  netlist_writer_reserve(writer, size);
+  memcpy(writer->data + writer->count, data, size);
+  writer->count += size;
+}
+
+void netlist_write_u32(Netlist_Writer *writer, u32 value) {
+  netlist_write_bytes(writer, &value, sizeof(value));
+}
+
+// formats straight into the free space, only what doesn't fit is
+// formatted again after growing
+void netlist_write_text(Netlist_Writer *writer, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  va_list retry_args;
+  va_copy(retry_args, args);
+  char *at = writer->data ? (char *)writer->data + writer->count : nullptr;
+  i32 length = vsnprintf(at, writer->capacity - writer->count, format, args);
+  assert(length >= 0);
+  if ((u32)length + 1 > writer->capacity - writer->count) {
+    netlist_writer_reserve(writer, (u32)length + 1);
+    vsnprintf((char *)writer->data + writer->count, writer->capacity - writer->count, format, retry_args);
+  }
+  va_end(retry_args);
+  va_end(args);
+  writer->count += (u32)length;
+}
+
+// A composite is written as a definition, instances of the same
+// definition share one. defs are in dependency order, top last.
+struct Netlist_Export {
+  Gate_Id *defs;
+  u32 def_count;
+  u32 *def_indices;   // per gate, valid for definitions
+  u32 *parents;       // per gate, the definition it is a child of
+  u32 *wire_counts;   // per definition
+  const char **export_names; // per definition, memalloc'ed when it differs from the gate name
+  Hash_Map<const char *, u32> names; // export names taken so far
+  u32 gate_count;
+  u32 wire_count;
+  u32 pin_count;
+};
+
+Gate_Id netlist_export_def_of(Gate_Store *gates, Gate_Id gate) {
+  Gate_Id result = gates->ops[gate] == GATE_INSTANCE ? gates->defs[gate] :
+                   gates->ops[gate] == GATE_COMPOSITE ? gate : GATE_NONE;
+  return result;
+}
+
+bool netlist_export_name_is_word(const char *name) {
+  bool result = *name != 0;
+  for (const char *at = name; *at; at++) {
+    if (netlist_is_space(*at) || *at == '\n' || *at == '#') result = false;
+  }
+  return result;
+}
+
+bool netlist_export_name_is_kind(const char *name) {
+  bool result = !strcmp(name, "and") || !strcmp(name, "not") || !strcmp(name, "dff") ||
+                !strcmp(name, "latch") || !strcmp(name, "in") || !strcmp(name, "out");
+  return result;
+}
+
+void netlist_export_collect(State *state, Netlist_Export *exp, u8 *visited, Gate_Id def) {
+  Gate_Store *gates = &state->gates;
+  const char **names = state->layout.names;
+  if (visited[def]) return;
+  visited[def] = true;
+
+  gate_for_children(gates, def, child) {
+    Gate_Id child_def = netlist_export_def_of(gates, child);
+    if (child_def != GATE_NONE) netlist_export_collect(state, exp, visited, child_def);
+  }
+
+  // local wires start at a child and end at a child of the same definition
+  u32 child_count = 0;
+  gate_for_children(gates, def, child) {
+    exp->parents[child] = def;
+    exp->pin_count += gates->in_counts[child] + gates->out_counts[child];
+    child_count++;
+  }
+  Wire_Index *wire_index = get_wire_index(state);
+  u32 wire_count = 0;
+  gate_for_children(gates, def, child) {
+    Wire_List fanout = wire_index_fanout(wire_index, child);
+    for (u32 w = 0; w < fanout.count; w++) {
+      if (exp->parents[state->wires.items[fanout.indices[w]].end] == def) wire_count++;
+    }
+  }
+
+  // a name has to come back as one word, so spaces and '#' become '_'
+  const char *export_name = names[def];
+  if (!netlist_export_name_is_word(export_name)) {
+    u32 length = (u32)strlen(export_name);
+    char *word = (char *)memalloc(max(length, (u32)1) + 1);
+    for (u32 i = 0; i < length; i++) {
+      char c = export_name[i];
+      word[i] = netlist_is_space(c) || c == '\n' || c == '#' ? '_' : c;
+    }
+    if (!length) word[length++] = '_';
+    word[length] = 0;
+    export_name = word;
+  }
+
+  // a repeated name, or one a g line would read as a primitive, becomes
+  // name.N, bumping N past names that are taken too, e.g. by a definition
+  // actually called name.N
+  if (netlist_export_name_is_kind(export_name) || hash_map_get(&exp->names, export_name)) {
+    const char *base = export_name;
+    for (u32 suffix = exp->def_count;; suffix++) {
+      u32 length = (u32)snprintf(nullptr, 0, "%s.%u", base, (unsigned)suffix);
+      char *candidate = (char *)memalloc(length + 1);
+      snprintf(candidate, length + 1, "%s.%u", base, (unsigned)suffix);
+      if (!hash_map_get(&exp->names, (const char *)candidate)) {
+        export_name = candidate;
+        break;
+      }
+      memfree(candidate);
+    }
+    if (base != names[def]) memfree((void *)base);
+  }
+  hash_map_put(&exp->names, export_name, exp->def_count);
+
+  exp->def_indices[def] = exp->def_count;
+  exp->export_names[exp->def_count] = export_name;
+  exp->wire_counts[exp->def_count] = wire_count;
+  exp->defs[exp->def_count++] = def;
+  exp->gate_count += 1 + child_count;
+  exp->wire_count += wire_count;
+  exp->pin_count += gates->in_counts[def] + gates->out_counts[def];
+}
+
+void netlist_export_write_name(Netlist_Writer *writer, Netlist_Export *exp, u32 def_index) {
+  netlist_write_text(writer, "%s", exp->export_names[def_index]);
+}
+
+// Kind of a child, and for in/out the pin of def it stands for.
+u32 netlist_export_kind(Netlist_Export *exp, Gate_Store *gates, Gate_Id def, Gate_Id child, u32 *pin) {
+  u32 kind = NETLIST_KIND_AND;
+  *pin = 0;
+  switch (gates->ops[child]) {
+    case GATE_AND: kind = NETLIST_KIND_AND; break;
+    case GATE_NOT: kind = NETLIST_KIND_NOT; break;
+    case GATE_DFF: kind = NETLIST_KIND_DFF; break;
+    case GATE_LATCH: kind = NETLIST_KIND_LATCH; break;
+
+    case GATE_IN:
+    case GATE_OUT: {
+      bool is_in = gates->ops[child] == GATE_IN;
+      kind = is_in ? NETLIST_KIND_IN : NETLIST_KIND_OUT;
+      u32 first = gates->pin_offsets[def] + (is_in ? 0 : gates->in_counts[def]);
+      u32 count = is_in ? gates->in_counts[def] : gates->out_counts[def];
+      for (u32 i = 0; i < count; i++) {
+        if (gates->pin_gates[first + i] == child) *pin = i;
+      }
+    } break;
+
+    default: {
+      kind = NETLIST_KIND_FIRST_DEF + exp->def_indices[netlist_export_def_of(gates, child)];
+    } break;
+  }
+  return kind;
+}
+
+// Writes top and every definition under it, returns a memalloc'ed buffer.
+u8 *netlist_export(State *state, Gate_Id top, bool binary, u32 *size) {
+  Gate_Store *gates = &state->gates;
+  V2 *positions = state->layout.positions;
+  const char **names = state->layout.names;
+  u32 gate_count = gates->count;
+  Netlist_Export exp = {};
+  exp.defs = (Gate_Id *)memalloc(sizeof(Gate_Id)*(gate_count + 1));
+  exp.def_indices = (u32 *)memalloc(sizeof(u32)*(gate_count + 1));
+  exp.parents = (u32 *)memalloc(sizeof(u32)*(gate_count + 1));
+  memset(exp.parents, 0xFF, sizeof(u32)*(gate_count + 1));
+  exp.wire_counts = (u32 *)memalloc(sizeof(u32)*(gate_count + 1));
+  exp.export_names = (const char **)memalloc(sizeof(const char *)*(gate_count + 1));
+  exp.names = make_hash_map<const char *, u32>();
+  u32 *local = (u32 *)memalloc(sizeof(u32)*(gate_count + 1));
+  u8 *visited = (u8 *)memalloc(gate_count + 1);
+  memset(visited, 0, gate_count + 1);
+  Gate_Id top_def = netlist_export_def_of(gates, top);
+  netlist_export_collect(state, &exp, visited, top_def != GATE_NONE ? top_def : top);
+
+  Netlist_Writer writer = {};
+  if (binary) {
+    netlist_write_u32(&writer, NETLIST_BINARY_MAGIC);
+    netlist_write_u32(&writer, NETLIST_BINARY_VERSION);
+    netlist_write_u32(&writer, exp.def_count);
+    netlist_write_u32(&writer, exp.gate_count);
+    netlist_write_u32(&writer, exp.wire_count);
+    netlist_write_u32(&writer, exp.pin_count);
+  } else {
+    netlist_write_text(&writer, "lvl5net %u %u %u %u %u\n", NETLIST_TEXT_VERSION, (unsigned)exp.def_count,
+                       (unsigned)exp.gate_count, (unsigned)exp.wire_count, (unsigned)exp.pin_count);
+  }
+
+  Wire_Index *wire_index = get_wire_index(state);
+  for (u32 def_index = 0; def_index < exp.def_count; def_index++) {
+    Gate_Id def = exp.defs[def_index];
+    u32 child_count = 0;
+    gate_for_children(gates, def, child) child_count++;
+    if (binary) {
+      // the same names as text, an empty one wouldn't load
+      const char *name = exp.export_names[def_index];
+      u32 name_length = (u32)strlen(name);
+      u32 zero = 0;
+      netlist_write_u32(&writer, name_length);
+      netlist_write_bytes(&writer, (void *)name, name_length);
+      netlist_write_bytes(&writer, &zero, ((name_length + 3) & ~(u32)3) - name_length);
+      netlist_write_u32(&writer, gates->in_counts[def]);
+      netlist_write_u32(&writer, gates->out_counts[def]);
+      netlist_write_u32(&writer, child_count);
+      netlist_write_u32(&writer, exp.wire_counts[def_index]);
+    } else {
+      netlist_write_text(&writer, "def ");
+      netlist_export_write_name(&writer, &exp, def_index);
+      netlist_write_text(&writer, " %u %u %u %u\n", (unsigned)gates->in_counts[def],
+                         (unsigned)gates->out_counts[def], (unsigned)child_count,
+                         (unsigned)exp.wire_counts[def_index]);
+    }
+
+    u32 i = 0;
+    gate_for_children(gates, def, child) {
+      local[child] = i++;
+      u32 pin;
+      u32 kind = netlist_export_kind(&exp, gates, def, child, &pin);
+      V2 p = positions[child];
+      if (binary) {
+        netlist_write_u32(&writer, kind);
+        netlist_write_u32(&writer, pin);
+        netlist_write_bytes(&writer, &p, sizeof(V2));
+      } else if (kind == NETLIST_KIND_IN || kind == NETLIST_KIND_OUT) {
+        netlist_write_text(&writer, "g %s %u %.9g %.9g\n", names[child], (unsigned)pin, p.x, p.y);
+      } else if (kind >= NETLIST_KIND_FIRST_DEF) {
+        netlist_write_text(&writer, "g ");
+        netlist_export_write_name(&writer, &exp, kind - NETLIST_KIND_FIRST_DEF);
+        netlist_write_text(&writer, " %.9g %.9g\n", p.x, p.y);
+      } else {
+        netlist_write_text(&writer, "g %s %.9g %.9g\n", names[child], p.x, p.y);
+      }
+    }
+
+    gate_for_children(gates, def, child) {
+      Wire_List fanout = wire_index_fanout(wire_index, child);
+      for (u32 w = 0; w < fanout.count; w++) {
+        Wire *wire = &state->wires.items[fanout.indices[w]];
+        if (exp.parents[wire->end] != def) continue;
+        u32 start = local[child];
+        u32 end = local[wire->end];
+        if (binary) {
+          u32 record[4] = {start, wire->start_index, end, wire->end_index};
+          netlist_write_bytes(&writer, record, sizeof(record));
+        } else {
+          netlist_write_text(&writer, "w %u %u %u %u\n", (unsigned)start, (unsigned)wire->start_index,
+                             (unsigned)end, (unsigned)wire->end_index);
+        }
+      }
+    }
+  }
+
+  if (binary) {
+    netlist_write_u32(&writer, exp.def_count - 1);
+  } else {
+    netlist_write_text(&writer, "top ");
+    netlist_export_write_name(&writer, &exp, exp.def_count - 1);
+    netlist_write_text(&writer, "\n");
+  }
+
+  for (u32 def_index = 0; def_index < exp.def_count; def_index++) {
+    if (exp.export_names[def_index] != names[exp.defs[def_index]]) {
+      memfree((void *)exp.export_names[def_index]);
+    }
+  }
+  memfree(exp.defs);
+  memfree(exp.def_indices);
+  memfree(exp.parents);
+  memfree(exp.wire_counts);
+  memfree(exp.export_names);
+  hash_map_free(&exp.names);
+  memfree(local);
+  memfree(visited);
+
+  *size = writer.count;
+  return writer.data;
+}